@@ -1,9 +1,13 @@
 #include "APU.h"
 #include "../CPU.h"
+#include "../SaveState.h"
+#ifndef NESPRIME_HEADLESS
 #include "../Display.h"
+#endif
 
 APU::APU()
 {
+#ifndef NESPRIME_HEADLESS
 	SDL_zero( audio_spec );
 	audio_spec.freq = SAMPLE_RATE * 1;
 	audio_spec.format = AUDIO_F32SYS;
@@ -14,6 +18,7 @@ APU::APU()
 	audio_device = SDL_OpenAudioDevice( nullptr, 0, &audio_spec, nullptr, 0 );
 
 	SDL_PauseAudioDevice( audio_device, 0 );
+#endif
 
 	sc_2a03.frameSeq.set_chip( &sc_2a03 );
 	sc_2a03.pulse[1].set_p2( true );
@@ -21,7 +26,9 @@ APU::APU()
 
 APU::~APU()
 {
+#ifndef NESPRIME_HEADLESS
 	SDL_CloseAudioDevice( audio_device );
+#endif
 }
 
 void APU::init()
@@ -29,7 +36,9 @@ void APU::init()
 	sc_2a03.dmc.set_cpu( get_nes()->get_cpu() );
 	Mapper *mapper = nes->get_cpu()->get_mapper();
 	mapper->set_sound_chip( get_chip( mapper->get_sound_chip_type() ) );
+#ifndef NESPRIME_HEADLESS
 	nes->get_display()->init_apu_display();
+#endif
 }
 
 void APU::cycle()
@@ -54,6 +63,7 @@ void APU::sample()
 		downsample();
 		sample_clock -= sample_per * nes->get_emu_speed();
 
+#ifndef NESPRIME_HEADLESS
 		if ( nes->DEBUG_APU )
 		{
 			std::vector<float> debug_waveforms;
@@ -70,12 +80,16 @@ void APU::sample()
 
 			nes->get_display()->push_apu_samples(debug_waveforms);
 		}
+#endif
 		sample_buffer_raw.clear();
 	}
 	
 	if ( sample_buffer.size() >= 100 )
 	{
+#ifndef NESPRIME_HEADLESS
 		SDL_QueueAudio( audio_device, sample_buffer.data(), sample_buffer.size() * 4 );
+#endif
+		samples_queued += sample_buffer.size();
 		sample_buffer.clear();
 	}
 }
@@ -131,6 +145,22 @@ u8 APU::read_status()
 	return s;
 }
 
+long APU::cycles_until_dmc_fetch()
+{
+	long ticks = sc_2a03.dmc.ticks_until_fetch();
+	return ticks < 0 ? -1 : sc_2a03.cycles_until_tick( ticks );
+}
+
+long APU::cycles_until_irq()
+{
+	if ( sc_2a03.frameSeq.interrupt || sc_2a03.dmc.get_irq_pending() )
+	{
+		return 0;
+	}
+	long ticks = sc_2a03.frameSeq.ticks_until_interrupt();
+	return ticks < 0 ? -1 : sc_2a03.cycles_until_tick( ticks );
+}
+
 SoundChip *APU::get_chip( SCType type )
 {
 	switch ( type )
@@ -142,4 +172,15 @@ SoundChip *APU::get_chip( SCType type )
 		default:
 			return nullptr;
 	}
+}
+
+void APU::serialize( SaveState &save )
+{
+	sc_2a03.serialize( save );
+	sc_5b.serialize( save );
+	save.io( sample_buffer_raw );
+	save.io( sample_buffer );
+	save.io( low_pass_last );
+	save.io( sample_clock );
+	save.io( samples_queued );
 }
\ No newline at end of file
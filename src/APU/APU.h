@@ -1,6 +1,8 @@
 #pragma once
 
+#ifndef NESPRIME_HEADLESS
 #include "SDL.h"
+#endif
 #include "../Component.h"
 #include "Channel.h"
 #include "Units.h"
@@ -25,8 +27,19 @@ public:
 
 	u8 read_status();
 
+	long cycles_until_dmc_fetch();
+
+	long cycles_until_irq();
+
 	SoundChip *get_chip( SCType type );
 
+	void serialize( SaveState &save );
+
+	long get_samples_queued() const
+	{
+		return samples_queued;
+	}
+
 private:
 	void sample();
 
@@ -36,15 +49,18 @@ private:
 
 	void downsample();
 
+#ifndef NESPRIME_HEADLESS
 public:
 	SDL_AudioDeviceID audio_device;
 private:
 	SDL_AudioSpec audio_spec;
+#endif
 
 	std::deque< float > sample_buffer_raw;
 	std::vector< float > sample_buffer;
 	float low_pass_last = 0;
 	float sample_clock = 0;
+	long samples_queued = 0;
 
 	static constexpr float SAMPLE_RATE = 44100.0;
 	static constexpr float sample_per = 21477272 / SAMPLE_RATE / 12.0;
@@ -1,5 +1,6 @@
 #include <iostream>
 #include "Channel.h"
+#include "../SaveState.h"
 
 void Channel::set_timer_hi( u8 hi )
 {
@@ -161,4 +162,67 @@ float Channel::get_output()
 float Channel::peek_output()
 {
 	return dac_out_last;
+}
+void Channel::serialize( SaveState &save )
+{
+	save.io( enabled );
+	save.io( timer );
+	sequencer.serialize( save );
+	save.io( envelope );
+	save.io( seq_out );
+	save.io( dac_in_last );
+	save.io( dac_out_last );
+	save.io( length );
+	save.io( length_halt );
+}
+
+void Pulse::serialize( SaveState &save )
+{
+	Channel::serialize( save );
+	save.io( duty );
+	save.io( sweep_divider );
+	save.io( sweep_enable );
+	save.io( sweep_negate );
+	save.io( sweep_reload );
+	save.io( sweep_shift );
+	save.io( sweep_period );
+	save.io( muted );
+	if ( save.is_loading() )
+	{
+		duty &= 0x3;
+		sequencer.sequence = seqs[duty];
+	}
+}
+
+void Triangle::serialize( SaveState &save )
+{
+	Channel::serialize( save );
+	save.io( linear_counter );
+	save.io( counter_reload_val );
+	save.io( flag_linc_reload );
+}
+
+void Noise::serialize( SaveState &save )
+{
+	Channel::serialize( save );
+	save.io( mode );
+	save.io( shifter );
+}
+
+void DMC::serialize( SaveState &save )
+{
+	Channel::serialize( save );
+	save.io( irq_enabled );
+	save.io( irq_pending );
+	save.io( loop );
+	save.io( sample_buffer );
+	save.io( sample_buffer_empty );
+	save.io( sample_addr );
+	save.io( sample_length );
+	save.io( addr_counter );
+	save.io( bytes_remaining );
+	save.io( shifter );
+	save.io( bits_remaining );
+	save.io( output );
+	save.io( silence );
 }
\ No newline at end of file
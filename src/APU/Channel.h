@@ -89,6 +89,8 @@ public:
 
 	float peek_output();
 
+	virtual void serialize( SaveState &save );
+
 public:
 	bool debug_muted = false;
 
@@ -144,6 +146,8 @@ public:
 
 	void tick_sweep();
 
+	void serialize( SaveState &save ) override;
+
 	bool is_playing() override
 	{
 		return enabled && timer.get_period() > 8 && !muted && length > 0 && envelope.get_volume() > 0;
@@ -195,6 +199,8 @@ public:
 
 	u8 get_dac_in() override;
 
+	void serialize( SaveState &save ) override;
+
 	bool is_playing() override
 	{
 		return enabled && timer.get_period() >= 2 && (length > 0 && linear_counter > 0);
@@ -234,6 +240,8 @@ public:
 
 	u8 get_dac_in() override;
 
+	void serialize( SaveState &save ) override;
+
 	bool is_playing() override
 	{
 		return enabled && length > 0;
@@ -314,8 +322,21 @@ public:
 		return irq_pending;
 	}
 
+	long ticks_until_fetch() const
+	{
+		if ( bytes_remaining == 0 )
+		{
+			return -1;
+		}
+		// A full buffer is only emptied once the output unit runs out of bits
+		long fires = sample_buffer_empty ? 0 : bits_remaining + 1;
+		return timer.get_counter() + fires * (timer.get_period() + 1);
+	}
+
 	u8 get_dac_in() override;
 
+	void serialize( SaveState &save ) override;
+
 	bool is_playing() override
 	{
 		return true;
@@ -358,7 +379,12 @@ private:
 	{
 		if ( sample_buffer_empty && bytes_remaining > 0 )
 		{
-			sample_buffer = *cpu->get_mapper()->map_cpu(addr_counter);
+			const u8 *sample = cpu->get_mapper()->map_cpu(addr_counter);
+			sample_buffer = *sample;
+			if ( cpu->get_cdl() != nullptr )
+			{
+				cpu->get_cdl()->mark_prg( cpu->get_mapper()->prg_rom_offset( sample ), CodeDataLog::DMC );
+			}
 			sample_buffer_empty = false;
 
 			if ( ++addr_counter == 0x0 )
@@ -378,7 +404,7 @@ private:
 				}
 			}
 
-			cpu->skip_cycles( 4, READ ); // TODO make more accurate
+			cpu->stall( 4 ); // TODO make more accurate
 		}
 	}
 
@@ -1,4 +1,5 @@
 #include "SC_2A03.h"
+#include "../SaveState.h"
 
 Channel *SC_2A03::get_channel( int channel )
 {
@@ -128,4 +129,15 @@ std::string SC_2A03::get_debug_note_name( int channel )
 {
 	if ( channel > 2 ) return "";
 	return get_channel(channel)->is_playing() ? freq_to_note( 1789773.0 / 16 / (channel < 2 ? (pulse[ channel ].get_period()) : (triangle.get_period() * 2)) ) : "--";
+}
+
+void SC_2A03::serialize( SaveState &save )
+{
+	pulse[ 0 ].serialize( save );
+	pulse[ 1 ].serialize( save );
+	triangle.serialize( save );
+	noise.serialize( save );
+	dmc.serialize( save );
+	frameSeq.serialize( save );
+	save.io( tick_fs );
 }
\ No newline at end of file
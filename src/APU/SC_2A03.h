@@ -15,6 +15,8 @@ public:
 
 	void clock() override;
 
+	void serialize( SaveState &save ) override;
+
 	float get_output() override;
 
 	int get_channel_count() override
@@ -80,6 +82,12 @@ public:
 
 	virtual std::string get_debug_note_name( int channel ) override;
 
+	// APU cycles until the frame sequencer and DMC have been clocked `ticks` more times
+	long cycles_until_tick( long ticks ) const
+	{
+		return (tick_fs ? 0 : 1) + ticks * 2;
+	}
+
 private:
 	Pulse pulse[ 2 ];
 	Triangle triangle;
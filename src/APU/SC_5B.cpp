@@ -1,4 +1,5 @@
 #include "SC_5B.h"
+#include "../SaveState.h"
 
 void Square_5B::tick_timer()
 {
@@ -25,6 +26,15 @@ float Square_5B::get_output()
 	return debug_muted ? 0 : dac_out_last;
 }
 
+void Square_5B::serialize( SaveState &save )
+{
+	Pulse::serialize( save );
+	save.io( clock_counter );
+	save.io( period );
+	save.io( timer );
+	save.io( env_volume );
+}
+
 void Square_5B::init_lookup()
 {
 	for ( int i = 0; i < DAC_STEPS; ++i )
@@ -83,4 +93,12 @@ std::string SC_5B::get_debug_note_name( int channel )
 {
 	if ( channel >= get_channel_count() ) return "";
 	return get_channel( channel )->is_playing() ? freq_to_note( 1789773.0 / 16 / square[ channel ].get_period() / 2 ) : "--";
+}
+
+void SC_5B::serialize( SaveState &save )
+{
+	for ( int i = 0; i < 3; ++i )
+	{
+		square[ i ].serialize( save );
+	}
 }
\ No newline at end of file
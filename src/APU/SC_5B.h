@@ -40,6 +40,8 @@ public:
 
 	float get_output() override;
 
+	void serialize( SaveState &save ) override;
+
 	bool is_playing() override
 	{
 		return enabled && timer > 0 && env_volume > 0;
@@ -66,6 +68,8 @@ public:
 
 	void clock() override;
 
+	void serialize( SaveState &save ) override;
+
 	float get_output() override
 	{
 		return 0.0045 * (square[ 0 ].get_output() + square[ 1 ].get_output() + square[ 2 ].get_output());
@@ -23,6 +23,8 @@ public:
 
 	virtual void clock() = 0;
 
+	virtual void serialize( SaveState &save ) = 0;
+
 	virtual int get_channel_count() = 0;
 
 	virtual std::string get_name() = 0;
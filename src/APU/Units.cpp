@@ -1,6 +1,7 @@
 #include "Units.h"
 #include "APU.h"
 #include "../CPU.h"
+#include "../SaveState.h"
 
 bool Divider::clock()
 {
@@ -35,6 +36,12 @@ u8 Sequencer::next()
 	return val;
 }
 
+void Sequencer::serialize( SaveState &save )
+{
+	save.io( steps );
+	save.io( step );
+}
+
 void Envelope::clock()
 {
 	if ( !start )
@@ -116,6 +123,29 @@ void FrameSequencer::do_seq( u8 seq )
 	}
 }
 
+long FrameSequencer::ticks_until_interrupt() const
+{
+	if ( interrupt )
+	{
+		return 0;
+	}
+	if ( irq_disable || sequencer.steps != 4 )
+	{
+		return -1;
+	}
+	// The sequencer counts down, raising the interrupt on step 3
+	long fires = (sequencer.step + 1) % 4;
+	return divider.get_counter() + fires * (divider.get_period() + 1);
+}
+
+void FrameSequencer::serialize( SaveState &save )
+{
+	save.io( interrupt );
+	save.io( divider );
+	sequencer.serialize( save );
+	save.io( irq_disable );
+}
+
 void FrameSequencer::set_interrupt()
 {
 	if ( !irq_disable )
@@ -4,6 +4,8 @@
 
 class SC_2A03;
 
+class SaveState;
+
 class Divider
 {
 public:
@@ -58,6 +60,8 @@ public:
 		step = 0;
 	}
 
+	void serialize( SaveState &save );
+
 	u8 steps;
 	u8 step;
 	const u8 *sequence;
@@ -129,6 +133,10 @@ public:
 	{
 		sc = sc_2a03;
 	};
+
+	long ticks_until_interrupt() const;
+
+	void serialize( SaveState &save );
 private:
 	void set_interrupt();
 
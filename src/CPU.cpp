@@ -7,6 +7,254 @@
 #include "PPU.h"
 #include "IO.h"
 #include "APU/APU.h"
+#include "SaveState.h"
+
+constexpr std::array< opcode_info, 256 > CPU::build_opcode_table()
+{
+	const opcode_entry listing[] = {
+		{0x69, {Op::ADC, &CPU::ADC,  Immediate,        2}},
+		{0x65, {Op::ADC, &CPU::ADC,  ZeroPage,         3}},
+		{0x75, {Op::ADC, &CPU::ADC,  IndexedZeroX,     4}},
+		{0x6D, {Op::ADC, &CPU::ADC,  Absolute,         4}},
+		{0x7D, {Op::ADC, &CPU::ADC,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}},
+		{0x79, {Op::ADC, &CPU::ADC,  IndexedAbsoluteY, 4 + PAGE_SENSITIVE}},
+		{0x61, {Op::ADC, &CPU::ADC,  IndexedIndirectX, 6}},
+		{0x71, {Op::ADC, &CPU::ADC,  IndexedIndirectY, 5 + PAGE_SENSITIVE}},
+		{0x29, {Op::AND, &CPU::AND,  Immediate,        2}},
+		{0x25, {Op::AND, &CPU::AND,  ZeroPage,         3}},
+		{0x35, {Op::AND, &CPU::AND,  IndexedZeroX,     4}},
+		{0x2D, {Op::AND, &CPU::AND,  Absolute,         4}},
+		{0x3D, {Op::AND, &CPU::AND,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}},
+		{0x39, {Op::AND, &CPU::AND,  IndexedAbsoluteY, 4 + PAGE_SENSITIVE}},
+		{0x21, {Op::AND, &CPU::AND,  IndexedIndirectX, 6}},
+		{0x31, {Op::AND, &CPU::AND,  IndexedIndirectY, 5 + PAGE_SENSITIVE}},
+		{0x0A, {Op::ASL, &CPU::ASL,  Accumulator,      2}},
+		{0x06, {Op::ASL, &CPU::ASL,  ZeroPage,         5}},
+		{0x16, {Op::ASL, &CPU::ASL,  IndexedZeroX,     6}},
+		{0x0E, {Op::ASL, &CPU::ASL,  Absolute,         6}},
+		{0x1E, {Op::ASL, &CPU::ASL,  IndexedAbsoluteX, 7}},
+		{0x90, {Op::BCC, &CPU::BCC,  Relative,         2}},
+		{0xB0, {Op::BCS, &CPU::BCS,  Relative,         2}},
+		{0xF0, {Op::BEQ, &CPU::BEQ,  Relative,         2}},
+		{0x24, {Op::BIT, &CPU::BIT,  ZeroPage,         3}},
+		{0x2C, {Op::BIT, &CPU::BIT,  Absolute,         4}},
+		{0x30, {Op::BMI, &CPU::BMI,  Relative,         2}},
+		{0xD0, {Op::BNE, &CPU::BNE,  Relative,         2}},
+		{0x10, {Op::BPL, &CPU::BPL,  Relative,         2}},
+		{0x00, {Op::BRK, &CPU::BRK,  Implicit,         7}},
+		{0x50, {Op::BVC, &CPU::BVC,  Relative,         2}},
+		{0x70, {Op::BVS, &CPU::BVS,  Relative,         2}},
+		{0x18, {Op::CLC, &CPU::CLC,  Implicit,         2}},
+		{0xD8, {Op::CLD, &CPU::CLD,  Implicit,         2}},
+		{0x58, {Op::CLI, &CPU::CLI,  Implicit,         2}},
+		{0xB8, {Op::CLV, &CPU::CLV,  Implicit,         2}},
+		{0xC9, {Op::CMP, &CPU::CMP,  Immediate,        2}},
+		{0xC5, {Op::CMP, &CPU::CMP,  ZeroPage,         3}},
+		{0xD5, {Op::CMP, &CPU::CMP,  IndexedZeroX,     4}},
+		{0xCD, {Op::CMP, &CPU::CMP,  Absolute,         4}},
+		{0xDD, {Op::CMP, &CPU::CMP,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}},
+		{0xD9, {Op::CMP, &CPU::CMP,  IndexedAbsoluteY, 4 + PAGE_SENSITIVE}},
+		{0xC1, {Op::CMP, &CPU::CMP,  IndexedIndirectX, 6}},
+		{0xD1, {Op::CMP, &CPU::CMP,  IndexedIndirectY, 5 + PAGE_SENSITIVE}},
+		{0xE0, {Op::CPX, &CPU::CPX,  Immediate,        2}},
+		{0xE4, {Op::CPX, &CPU::CPX,  ZeroPage,         3}},
+		{0xEC, {Op::CPX, &CPU::CPX,  Absolute,         4}},
+		{0xC0, {Op::CPY, &CPU::CPY,  Immediate,        2}},
+		{0xC4, {Op::CPY, &CPU::CPY,  ZeroPage,         3}},
+		{0xCC, {Op::CPY, &CPU::CPY,  Absolute,         4}},
+		{0xC7, {Op::DCP, &CPU::DCP,  ZeroPage,         5}}, //*//
+		{0xD7, {Op::DCP, &CPU::DCP,  IndexedZeroX,     6}}, //*//
+		{0xCF, {Op::DCP, &CPU::DCP,  Absolute,         6}}, //*//
+		{0xDF, {Op::DCP, &CPU::DCP,  IndexedAbsoluteX, 7}}, //*//
+		{0xDB, {Op::DCP, &CPU::DCP,  IndexedAbsoluteY, 7}}, //*//
+		{0xC3, {Op::DCP, &CPU::DCP,  IndexedIndirectX, 8}}, //*//
+		{0xD3, {Op::DCP, &CPU::DCP,  IndexedIndirectY, 8}}, //*//
+		{0xC6, {Op::DEC, &CPU::DEC,  ZeroPage,         5}},
+		{0xD6, {Op::DEC, &CPU::DEC,  IndexedZeroX,     6}},
+		{0xCE, {Op::DEC, &CPU::DEC,  Absolute,         6}},
+		{0xDE, {Op::DEC, &CPU::DEC,  IndexedAbsoluteX, 7}},
+		{0xCA, {Op::DEX, &CPU::DEX,  Implicit,         2}},
+		{0x88, {Op::DEY, &CPU::DEY,  Implicit,         2}},
+		{0x49, {Op::EOR, &CPU::EOR,  Immediate,        2}},
+		{0x45, {Op::EOR, &CPU::EOR,  ZeroPage,         3}},
+		{0x55, {Op::EOR, &CPU::EOR,  IndexedZeroX,     4}},
+		{0x4D, {Op::EOR, &CPU::EOR,  Absolute,         4}},
+		{0x5D, {Op::EOR, &CPU::EOR,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}},
+		{0x59, {Op::EOR, &CPU::EOR,  IndexedAbsoluteY, 4 + PAGE_SENSITIVE}},
+		{0x41, {Op::EOR, &CPU::EOR,  IndexedIndirectX, 6}},
+		{0x51, {Op::EOR, &CPU::EOR,  IndexedIndirectY, 5 + PAGE_SENSITIVE}},
+		{0xE6, {Op::INC, &CPU::INC,  ZeroPage,         5}},
+		{0xF6, {Op::INC, &CPU::INC,  IndexedZeroX,     6}},
+		{0xEE, {Op::INC, &CPU::INC,  Absolute,         6}},
+		{0xFE, {Op::INC, &CPU::INC,  IndexedAbsoluteX, 7}},
+		{0xE8, {Op::INX, &CPU::INX,  Implicit,         2}},
+		{0xC8, {Op::INY, &CPU::INY,  Implicit,         2}},
+		{0xE7, {Op::ISB, &CPU::ISB,  ZeroPage,         5}}, //*//
+		{0xF7, {Op::ISB, &CPU::ISB,  IndexedZeroX,     6}}, //*//
+		{0xEF, {Op::ISB, &CPU::ISB,  Absolute,         6}}, //*//
+		{0xFF, {Op::ISB, &CPU::ISB,  IndexedAbsoluteX, 7}}, //*//
+		{0xFB, {Op::ISB, &CPU::ISB,  IndexedAbsoluteY, 7}}, //*//
+		{0xE3, {Op::ISB, &CPU::ISB,  IndexedIndirectX, 8}}, //*//
+		{0xF3, {Op::ISB, &CPU::ISB,  IndexedIndirectY, 8}}, //*//
+		{0x4C, {Op::JMP, &CPU::JMP,  Absolute,         3}},
+		{0x6C, {Op::JMP, &CPU::JMP,  Indirect,         5}},
+		{0x20, {Op::JSR, &CPU::JSR,  Absolute,         6}},
+		{0xA7, {Op::LAX, &CPU::LAX,  ZeroPage,         3}}, //*//
+		{0xB7, {Op::LAX, &CPU::LAX,  IndexedZeroY,     4}}, //*//
+		{0xAF, {Op::LAX, &CPU::LAX,  Absolute,         4}}, //*//
+		{0xBF, {Op::LAX, &CPU::LAX,  IndexedAbsoluteY, 4 + PAGE_SENSITIVE}}, //*//
+		{0xA3, {Op::LAX, &CPU::LAX,  IndexedIndirectX, 6}}, //*//
+		{0xB3, {Op::LAX, &CPU::LAX,  IndexedIndirectY, 5 + PAGE_SENSITIVE}}, //*//
+		{0xA9, {Op::LDA, &CPU::LDA,  Immediate,        2}},
+		{0xA5, {Op::LDA, &CPU::LDA,  ZeroPage,         3}},
+		{0xB5, {Op::LDA, &CPU::LDA,  IndexedZeroX,     4}},
+		{0xAD, {Op::LDA, &CPU::LDA,  Absolute,         4}},
+		{0xBD, {Op::LDA, &CPU::LDA,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}},
+		{0xB9, {Op::LDA, &CPU::LDA,  IndexedAbsoluteY, 4 + PAGE_SENSITIVE}},
+		{0xA1, {Op::LDA, &CPU::LDA,  IndexedIndirectX, 6}},
+		{0xB1, {Op::LDA, &CPU::LDA,  IndexedIndirectY, 5 + PAGE_SENSITIVE}},
+		{0xA2, {Op::LDX, &CPU::LDX,  Immediate,        2}},
+		{0xA6, {Op::LDX, &CPU::LDX,  ZeroPage,         3}},
+		{0xB6, {Op::LDX, &CPU::LDX,  IndexedZeroY,     4}},
+		{0xAE, {Op::LDX, &CPU::LDX,  Absolute,         4}},
+		{0xBE, {Op::LDX, &CPU::LDX,  IndexedAbsoluteY, 4 + PAGE_SENSITIVE}},
+		{0xA0, {Op::LDY, &CPU::LDY,  Immediate,        2}},
+		{0xA4, {Op::LDY, &CPU::LDY,  ZeroPage,         3}},
+		{0xB4, {Op::LDY, &CPU::LDY,  IndexedZeroX,     4}},
+		{0xAC, {Op::LDY, &CPU::LDY,  Absolute,         4}},
+		{0xBC, {Op::LDY, &CPU::LDY,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}},
+		{0x4A, {Op::LSR, &CPU::LSR,  Accumulator,      2}},
+		{0x46, {Op::LSR, &CPU::LSR,  ZeroPage,         5}},
+		{0x56, {Op::LSR, &CPU::LSR,  IndexedZeroX,     6}},
+		{0x4E, {Op::LSR, &CPU::LSR,  Absolute,         6}},
+		{0x5E, {Op::LSR, &CPU::LSR,  IndexedAbsoluteX, 7}},
+		{0xEA, {Op::NOP, &CPU::NOP,  Implicit,         2}},
+		{0x09, {Op::ORA, &CPU::ORA,  Immediate,        2}},
+		{0x05, {Op::ORA, &CPU::ORA,  ZeroPage,         3}},
+		{0x15, {Op::ORA, &CPU::ORA,  IndexedZeroX,     4}},
+		{0x0D, {Op::ORA, &CPU::ORA,  Absolute,         4}},
+		{0x1D, {Op::ORA, &CPU::ORA,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}},
+		{0x19, {Op::ORA, &CPU::ORA,  IndexedAbsoluteY, 4 + PAGE_SENSITIVE}},
+		{0x01, {Op::ORA, &CPU::ORA,  IndexedIndirectX, 6}},
+		{0x11, {Op::ORA, &CPU::ORA,  IndexedIndirectY, 5 + PAGE_SENSITIVE}},
+		{0x48, {Op::PHA, &CPU::PHA,  Implicit,         3}},
+		{0x08, {Op::PHP, &CPU::PHP,  Implicit,         3}},
+		{0x68, {Op::PLA, &CPU::PLA,  Implicit,         4}},
+		{0x28, {Op::PLP, &CPU::PLP,  Implicit,         4}},
+		{0x27, {Op::RLA, &CPU::RLA,  ZeroPage,         5}}, //*//
+		{0x37, {Op::RLA, &CPU::RLA,  IndexedZeroX,     6}}, //*//
+		{0x2F, {Op::RLA, &CPU::RLA,  Absolute,         6}}, //*//
+		{0x3F, {Op::RLA, &CPU::RLA,  IndexedAbsoluteX, 7}}, //*//
+		{0x3B, {Op::RLA, &CPU::RLA,  IndexedAbsoluteY, 7}}, //*//
+		{0x23, {Op::RLA, &CPU::RLA,  IndexedIndirectX, 8}}, //*//
+		{0x33, {Op::RLA, &CPU::RLA,  IndexedIndirectY, 8}}, //*//
+		{0x2A, {Op::ROL, &CPU::ROL,  Accumulator,      2}},
+		{0x26, {Op::ROL, &CPU::ROL,  ZeroPage,         5}},
+		{0x36, {Op::ROL, &CPU::ROL,  IndexedZeroX,     6}},
+		{0x2E, {Op::ROL, &CPU::ROL,  Absolute,         6}},
+		{0x3E, {Op::ROL, &CPU::ROL,  IndexedAbsoluteX, 7}},
+		{0x6A, {Op::ROR, &CPU::ROR,  Accumulator,      2}},
+		{0x66, {Op::ROR, &CPU::ROR,  ZeroPage,         5}},
+		{0x76, {Op::ROR, &CPU::ROR,  IndexedZeroX,     6}},
+		{0x6E, {Op::ROR, &CPU::ROR,  Absolute,         6}},
+		{0x7E, {Op::ROR, &CPU::ROR,  IndexedAbsoluteX, 7}},
+		{0x67, {Op::RRA, &CPU::RRA,  ZeroPage,         5}}, //*//
+		{0x77, {Op::RRA, &CPU::RRA,  IndexedZeroX,     6}}, //*//
+		{0x6F, {Op::RRA, &CPU::RRA,  Absolute,         6}}, //*//
+		{0x7F, {Op::RRA, &CPU::RRA,  IndexedAbsoluteX, 7}}, //*//
+		{0x7B, {Op::RRA, &CPU::RRA,  IndexedAbsoluteY, 7}}, //*//
+		{0x63, {Op::RRA, &CPU::RRA,  IndexedIndirectX, 8}}, //*//
+		{0x73, {Op::RRA, &CPU::RRA,  IndexedIndirectY, 8}}, //*//
+		{0x40, {Op::RTI, &CPU::RTI,  Implicit,         6}},
+		{0x60, {Op::RTS, &CPU::RTS,  Implicit,         6}},
+		{0x87, {Op::SAX, &CPU::SAX,  ZeroPage,         3}}, //*//
+		{0x97, {Op::SAX, &CPU::SAX,  IndexedZeroY,     4}}, //*//
+		{0x8F, {Op::SAX, &CPU::SAX,  Absolute,         4}}, //*//
+		{0x83, {Op::SAX, &CPU::SAX,  IndexedIndirectX, 6}}, //*//
+		{0xE9, {Op::SBC, &CPU::SBC,  Immediate,        2}},
+		{0xE5, {Op::SBC, &CPU::SBC,  ZeroPage,         3}},
+		{0xF5, {Op::SBC, &CPU::SBC,  IndexedZeroX,     4}},
+		{0xED, {Op::SBC, &CPU::SBC,  Absolute,         4}},
+		{0xFD, {Op::SBC, &CPU::SBC,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}},
+		{0xF9, {Op::SBC, &CPU::SBC,  IndexedAbsoluteY, 4 + PAGE_SENSITIVE}},
+		{0xE1, {Op::SBC, &CPU::SBC,  IndexedIndirectX, 6}},
+		{0xF1, {Op::SBC, &CPU::SBC,  IndexedIndirectY, 5 + PAGE_SENSITIVE}},
+		{0x38, {Op::SEC, &CPU::SEC,  Implicit,         2}},
+		{0xF8, {Op::SED, &CPU::SED,  Implicit,         2}},
+		{0x78, {Op::SEI, &CPU::SEI,  Implicit,         2}},
+		{0x07, {Op::SLO, &CPU::SLO,  ZeroPage,         5}}, //*//
+		{0x17, {Op::SLO, &CPU::SLO,  IndexedZeroX,     6}}, //*//
+		{0x0F, {Op::SLO, &CPU::SLO,  Absolute,         6}}, //*//
+		{0x1F, {Op::SLO, &CPU::SLO,  IndexedAbsoluteX, 7}}, //*//
+		{0x1B, {Op::SLO, &CPU::SLO,  IndexedAbsoluteY, 7}}, //*//
+		{0x03, {Op::SLO, &CPU::SLO,  IndexedIndirectX, 8}}, //*//
+		{0x13, {Op::SLO, &CPU::SLO,  IndexedIndirectY, 8}}, //*//
+		{0x47, {Op::SRE, &CPU::SRE,  ZeroPage,         5}}, //*//
+		{0x57, {Op::SRE, &CPU::SRE,  IndexedZeroX,     6}}, //*//
+		{0x4F, {Op::SRE, &CPU::SRE,  Absolute,         6}}, //*//
+		{0x5F, {Op::SRE, &CPU::SRE,  IndexedAbsoluteX, 7}}, //*//
+		{0x5B, {Op::SRE, &CPU::SRE,  IndexedAbsoluteY, 7}}, //*//
+		{0x43, {Op::SRE, &CPU::SRE,  IndexedIndirectX, 8}}, //*//
+		{0x53, {Op::SRE, &CPU::SRE,  IndexedIndirectY, 8}}, //*//
+		{0x85, {Op::STA, &CPU::STA,  ZeroPage,         3}},
+		{0x95, {Op::STA, &CPU::STA,  IndexedZeroX,     4}},
+		{0x8D, {Op::STA, &CPU::STA,  Absolute,         4}},
+		{0x9D, {Op::STA, &CPU::STA,  IndexedAbsoluteX, 5}},
+		{0x99, {Op::STA, &CPU::STA,  IndexedAbsoluteY, 5}},
+		{0x81, {Op::STA, &CPU::STA,  IndexedIndirectX, 6}},
+		{0x91, {Op::STA, &CPU::STA,  IndexedIndirectY, 6}},
+		{0x86, {Op::STX, &CPU::STX,  ZeroPage,         3}},
+		{0x96, {Op::STX, &CPU::STX,  IndexedZeroY,     4}},
+		{0x8E, {Op::STX, &CPU::STX,  Absolute,         4}},
+		{0x84, {Op::STY, &CPU::STY,  ZeroPage,         3}},
+		{0x94, {Op::STY, &CPU::STY,  IndexedZeroX,     4}},
+		{0x8C, {Op::STY, &CPU::STY,  Absolute,         4}},
+		{0xAA, {Op::TAX, &CPU::TAX,  Implicit,         2}},
+		{0xA8, {Op::TAY, &CPU::TAY,  Implicit,         2}},
+		{0xBA, {Op::TSX, &CPU::TSX,  Implicit,         2}},
+		{0x8A, {Op::TXA, &CPU::TXA,  Implicit,         2}},
+		{0x9A, {Op::TXS, &CPU::TXS,  Implicit,         2}},
+		{0x98, {Op::TYA, &CPU::TYA,  Implicit,         2}},
+		{0xEB, {Op::USBC, &CPU::USBC, Immediate,        2}}, //*//
+		// illegal NOPs
+		{0x1A, {Op::NOP, &CPU::NOP,  Implicit,         2}}, //*//
+		{0x3A, {Op::NOP, &CPU::NOP,  Implicit,         2}}, //*//
+		{0x5A, {Op::NOP, &CPU::NOP,  Implicit,         2}}, //*//
+		{0x7A, {Op::NOP, &CPU::NOP,  Implicit,         2}}, //*//
+		{0xDA, {Op::NOP, &CPU::NOP,  Implicit,         2}}, //*//
+		{0xFA, {Op::NOP, &CPU::NOP,  Implicit,         2}}, //*//
+		{0x80, {Op::NOP, &CPU::NOP,  Immediate,        2}}, //*//
+		{0x82, {Op::NOP, &CPU::NOP,  Immediate,        2}}, //*//
+		{0x89, {Op::NOP, &CPU::NOP,  Immediate,        2}}, //*//
+		{0xC2, {Op::NOP, &CPU::NOP,  Immediate,        2}}, //*//
+		{0xE2, {Op::NOP, &CPU::NOP,  Immediate,        2}}, //*//
+		{0x04, {Op::NOP, &CPU::NOP,  ZeroPage,         3}}, //*//
+		{0x44, {Op::NOP, &CPU::NOP,  ZeroPage,         3}}, //*//
+		{0x64, {Op::NOP, &CPU::NOP,  ZeroPage,         3}}, //*//
+		{0x14, {Op::NOP, &CPU::NOP,  IndexedZeroX,     4}}, //*//
+		{0x34, {Op::NOP, &CPU::NOP,  IndexedZeroX,     4}}, //*//
+		{0x54, {Op::NOP, &CPU::NOP,  IndexedZeroX,     4}}, //*//
+		{0x74, {Op::NOP, &CPU::NOP,  IndexedZeroX,     4}}, //*//
+		{0xD4, {Op::NOP, &CPU::NOP,  IndexedZeroX,     4}}, //*//
+		{0xF4, {Op::NOP, &CPU::NOP,  IndexedZeroX,     4}}, //*//
+		{0x0C, {Op::NOP, &CPU::NOP,  Absolute,         4}}, //*//
+		{0x1C, {Op::NOP, &CPU::NOP,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}}, //*//
+		{0x3C, {Op::NOP, &CPU::NOP,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}}, //*//
+		{0x5C, {Op::NOP, &CPU::NOP,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}}, //*//
+		{0x7C, {Op::NOP, &CPU::NOP,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}}, //*//
+		{0xDC, {Op::NOP, &CPU::NOP,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}}, //*//
+		{0xFC, {Op::NOP, &CPU::NOP,  IndexedAbsoluteX, 4 + PAGE_SENSITIVE}}, //*//
+	};
+
+	std::array< opcode_info, 256 > table{};
+	for ( const opcode_entry &entry : listing )
+	{
+		table[entry.opcode] = entry.info;
+	}
+	return table;
+}
+
+constinit const std::array< opcode_info, 256 > CPU::OPCODES = build_opcode_table();
 
 CPU::CPU() : Processor()
 {
@@ -31,17 +279,28 @@ void CPU::init()
 	}
 
 	reg.pc = create_address( read( 0xFFFC ), read( 0xFFFD ) );
-	reg.p = 0x24; // Initialize STATUS register to 00100100
+	set_p( 0x24 ); // Initialize STATUS register to 00100100
+
+	decode_cache.assign( mapper->get_prg_size(), {} );
+#ifdef NESPRIME_PROFILER
+	profiler.reset( mapper->get_prg_size() );
+#endif
 }
 
 bool CPU::run()
 {
+	idle_period = 0;
 	if ( oam_cycles > 0 )
 	{
+		loop_clean = false;
 		skip_cycles( 1, READ );
 		int i = 256 - oam_cycles--;
+		nes->catch_up();
 		nes->get_ppu()->write_oam( i, read( create_address( i, memory_regs[0x14]), false));
 		skip_cycles( 1, WRITE );
+#ifdef NESPRIME_PROFILER
+		profiler.dma( 2 );
+#endif
 		return true;
 	}
 
@@ -50,12 +309,25 @@ bool CPU::run()
 	pending_interrupt = -1;
 	suppress_skip_cycles = false;
 
+	nes->sync_if_due( get_status( STATUS::i ) );
 	if ( mapper->check_irq() )
 	{
 		trigger_irq();
 	}
 
-	exec( read( reg.pc ) );
+	if ( trace != nullptr )
+	{
+		trace_instruction();
+	}
+
+	u16 start_pc = reg.pc;
+#ifdef NESPRIME_PROFILER
+	long start_cycle = cycle;
+#endif
+	exec( fetch_opcode() );
+#ifdef NESPRIME_PROFILER
+	profile_instruction( start_pc, cycle - start_cycle );
+#endif
 
 	poll_interrupt();
 	PIN_NMI = false;
@@ -66,14 +338,95 @@ bool CPU::run()
 		interrupt( (INTERRUPT_TYPE)pending_interrupt );
 	}
 
+	if ( reg.pc <= start_pc )
+	{
+		check_idle_loop();
+	}
+
 	return true;
 }
 
+int CPU::instruction_size( ADDRESSING_MODE mode )
+{
+	switch ( mode )
+	{
+		case Implicit:
+		case Accumulator:
+			return 1;
+		case Absolute:
+		case IndexedAbsoluteX:
+		case IndexedAbsoluteY:
+		case Indirect:
+			return 3;
+		default:
+			return 2;
+	}
+}
+
+void CPU::check_idle_loop()
+{
+	// A mapper counting CPU cycles could raise an IRQ part way through the iterations skipped
+	if ( loop_clean && reg.pc == loop_reg.pc && reg.acc == loop_reg.acc && reg.x == loop_reg.x
+	     && reg.y == loop_reg.y && get_p() == loop_reg.p && reg.s == loop_reg.s && !mapper->clocks_cpu() )
+	{
+		idle_period = cycle - loop_cycle;
+		idle_instructions = instructions - loop_instructions;
+	}
+	loop_reg = reg;
+	loop_reg.p = get_p();
+	loop_cycle = cycle;
+	loop_instructions = instructions;
+	loop_clean = true;
+}
+
+void CPU::skip_idle_iterations( long iterations )
+{
+	long cycles = iterations * idle_period;
+	cycle += cycles;
+	instructions += iterations * idle_instructions;
+	loop_cycle += cycles;
+	loop_instructions += iterations * idle_instructions;
+	skipped_cycles += cycles;
+}
+
+void CPU::serialize( SaveState &save )
+{
+	Processor::serialize( save );
+	reg.p = get_p();
+	save.io( reg );
+	save.io( memory_regs );
+	save.io( PIN_NMI );
+	save.io( PIN_IRQ );
+	save.io( pending_interrupt );
+	save.io( polled_interrupt );
+	save.io( suppress_skip_cycles );
+	save.io( state );
+	save.io( curr_opcode );
+	save.io( ops );
+	save.io( addrs );
+	save.io( offset );
+	save.io( inc_pc );
+	save.io( oper_set );
+	save.io( oam_cycles );
+	save.io( instructions );
+	if ( save.is_loading() )
+	{
+		curr_op = OPCODES[curr_opcode];
+		set_p( reg.p );
+#ifdef NESPRIME_PROFILER
+		profiler.reset_stack();
+#endif
+		loop_clean = false;
+		idle_period = 0;
+	}
+}
+
 bool CPU::poll_interrupt()
 {
 	if ( !polled_interrupt )
 	{
 		polled_interrupt = true;
+		nes->sync_if_due( get_status( STATUS::i ) );
 
 		if ( PIN_NMI )
 		{
@@ -92,11 +445,15 @@ bool CPU::poll_interrupt()
 
 void CPU::interrupt( INTERRUPT_TYPE type )
 {
+#ifdef NESPRIME_PROFILER
+	long start_cycle = cycle;
+#endif
+	loop_clean = false;
 	if ( type != BREAK )
 	{
 		skip_cycles( 2, READ );
 	}
-	u8 push_p = type == BREAK ? reg.p | STATUS::b : reg.p & ~STATUS::b;
+	u8 push_p = type == BREAK ? get_p() | STATUS::b : get_p() & ~STATUS::b;
 	u16 vector = type == NMI ? 0xFFFA : 0xFFFE;
 	u16 push_addr = type == BREAK ? ++reg.pc + 1 : reg.pc;
 	if ( type == IRQ )
@@ -106,6 +463,33 @@ void CPU::interrupt( INTERRUPT_TYPE type )
 	push_address( push_addr );
 	push_stack( push_p );
 	reg.pc = read_address( vector );
+#ifdef NESPRIME_PROFILER
+	// A BRK is charged as an instruction, to the handler it enters
+	static constexpr Profiler::FrameKind KINDS[] = { Profiler::IRQ, Profiler::NMI, Profiler::BRK };
+	profiler.call( KINDS[type], reg.pc, rom_offset( reg.pc ), reg.s );
+	profiler.interrupt( cycle - start_cycle );
+#endif
+}
+
+#ifdef NESPRIME_PROFILER
+void CPU::profile_instruction( u16 pc, long cycles )
+{
+	profiler.instruction( pc, rom_offset( pc ), curr_opcode, cycles );
+	if ( curr_op.id == Op::JSR )
+	{
+		profiler.call( Profiler::CALL, reg.pc, rom_offset( reg.pc ), reg.s );
+	}
+	else if ( curr_op.id == Op::RTS || curr_op.id == Op::RTI )
+	{
+		profiler.ret( reg.s );
+	}
+}
+#endif
+
+long CPU::rom_offset( u16 addr ) const
+{
+	const u8 *page = mapper->cpu_read_page( addr );
+	return page == nullptr ? -1 : mapper->prg_rom_offset( page + (addr & Mapper::CPU_PAGE_MASK) );
 }
 
 void CPU::skip_cycles( int num, CYCLE type )
@@ -113,45 +497,124 @@ void CPU::skip_cycles( int num, CYCLE type )
 	for ( int i = 0; i < num; i++ )
 	{
 		state = type;
-		nes->tick( false, 12 - 1 * (i == num - 1) );
-		mapper->handle_cpu_cycle();
+		nes->advance( 12 - 1 * (i == num - 1) );
 		cycle++;
 	}
+	mapper->clock_cpu( num );
+}
+
+void CPU::stall( int num )
+{
+	// The instruction that got stalled takes longer than its loop normally does
+	loop_clean = false;
+	skip_cycles( num, READ );
 }
 
 u8 CPU::oper()
 {
 	if ( !oper_set )
 	{
-		ops[0] = read( addrs[0] );
+		if ( curr_op.mode == Immediate && cached_operands != nullptr )
+		{
+			skip_cycles( 1, READ );
+			ops[0] = cached_operands[0];
+			if ( trace != nullptr )
+			{
+				trace->record_bus( Trace::READ, reg.pc, ops[0], cycle );
+			}
+		}
+		else if ( curr_op.mode == Immediate )
+		{
+			// An immediate operand is part of the instruction, so it logs as code
+			ops[0] = fetch( addrs[0] );
+		}
+		else
+		{
+			ops[0] = read( addrs[0] );
+		}
 		oper_set = true;
 	}
 	return ops[0];
 }
 
-void CPU::exec( const u8 opcode )
+u8 CPU::fetch_opcode()
 {
-	inc_pc = true;
+	cached_operands = nullptr;
+	u16 in_page = reg.pc & Mapper::CPU_PAGE_MASK;
+	const u8 *page = mapper->cpu_read_page( reg.pc );
+	// Operands that spill into the next page may come from another bank, so those are decoded on the spot
+	long rom = page == nullptr || in_page > Mapper::CPU_PAGE_MASK - 2 ? -1 : mapper->prg_rom_offset( page + in_page );
+	if ( rom < 0 )
+	{
+		return fetch( reg.pc );
+	}
+
+	decoded_op &op = decode_cache[rom];
+	if ( !op.valid )
+	{
+		op.opcode = page[in_page];
+		op.operands[0] = page[in_page + 1];
+		op.operands[1] = page[in_page + 2];
+		op.valid = true;
+	}
+	skip_cycles( 1, READ );
+	if ( trace != nullptr )
+	{
+		trace->record_bus( Trace::READ, reg.pc, op.opcode, cycle );
+	}
+	if ( cdl != nullptr )
+	{
+		cdl->mark_prg( rom, instruction_size( OPCODES[op.opcode].mode ), CodeDataLog::CODE );
+	}
+	cached_operands = op.operands;
+	return op.opcode;
+}
 
-	auto it = OPCODES.find( opcode );
-	if ( it == OPCODES.end() )
+u8 CPU::next_byte()
+{
+	++reg.pc;
+	if ( cached_operands != nullptr )
 	{
-		if constexpr( logging )
+		skip_cycles( 1, READ );
+		if ( trace != nullptr )
 		{
-			nes->out << "\n\nError: unknown opcode! ";
-			print_hex( nes->out, opcode );
+			trace->record_bus( Trace::READ, reg.pc, *cached_operands, cycle );
 		}
-		exit;
+		return *cached_operands++;
 	}
+	return fetch( reg.pc );
+}
 
-	curr_op = it->second;
-	bool page_sensitive = ((curr_op.cycles & PAGE_SENSITIVE) >> 4) & 1;
+u8 CPU::fetch( u16 addr )
+{
+	u8 data = read_bus( addr, true );
+	if ( trace != nullptr )
+	{
+		trace->record_bus( Trace::READ, addr, data, cycle );
+	}
+	if ( cdl != nullptr )
+	{
+		cdl->mark_prg( rom_offset( addr ), CodeDataLog::CODE );
+	}
+	return data;
+}
+
+void CPU::exec( const u8 opcode )
+{
+	inc_pc = true;
 
-	bool phys = true;
-	if ( curr_op.id == Op::STA || curr_op.id == Op::STX || curr_op.id == Op::STY || curr_op.id == Op::INC )
+	++instructions;
+	curr_opcode = opcode;
+	curr_op = OPCODES[opcode];
+	if ( curr_op.op_func == nullptr )
 	{
-		phys = false;
+		// Carry on as if it were a plain NOP
+		curr_opcode = 0xEA;
+		curr_op = OPCODES[0xEA];
 	}
+
+	bool page_sensitive = ((curr_op.cycles & PAGE_SENSITIVE) >> 4) & 1;
+
 	switch ( curr_op.mode )
 	{
 		case Accumulator:
@@ -162,22 +625,22 @@ void CPU::exec( const u8 opcode )
 			break;
 		case Absolute:
 		{
-			u8 lo = read( ++reg.pc );
-			u8 hi = read( ++reg.pc );
+			u8 lo = next_byte();
+			u8 hi = next_byte();
 			addrs[0] = create_address( lo, hi );
 			break;
 		}
 		case ZeroPage:
 		{
-			u8 lo = read( ++reg.pc );
+			u8 lo = next_byte();
 			addrs[0] = lo;
 			break;
 		}
 		case IndexedAbsoluteX:
 		case IndexedAbsoluteY:
 		{
-			u8 lo = read( ++reg.pc );
-			u8 hi = read( ++reg.pc );
+			u8 lo = next_byte();
+			u8 hi = next_byte();
 			u16 addr = create_address( lo, hi );
 			addrs[0] = addr + (curr_op.mode == IndexedAbsoluteX ? reg.x : reg.y);
 			if ( !same_page( addr, addrs[0] ) && page_sensitive || !page_sensitive )
@@ -189,15 +652,15 @@ void CPU::exec( const u8 opcode )
 		case IndexedZeroX:
 		case IndexedZeroY:
 		{
-			u8 lo = read( ++reg.pc );
+			u8 lo = next_byte();
 			addrs[0] = (u8) (lo + (curr_op.mode == IndexedZeroX ? reg.x : reg.y));
 			skip_cycles( 1, READ );
 			break;
 		}
 		case Indirect:
 		{
-			u8 lo = read( ++reg.pc );
-			u8 hi = read( ++reg.pc );
+			u8 lo = next_byte();
+			u8 hi = next_byte();
 			u16 at = create_address( lo, hi );
 			addrs[0] = create_address( read( at ), read( (u8) (at + 1) | (at & 0xFF00) ) );
 			// Jump address wraps around in indirect mode due to 6502 bug
@@ -205,7 +668,7 @@ void CPU::exec( const u8 opcode )
 		}
 		case IndexedIndirectX:
 		{
-			u8 base = read( ++reg.pc );
+			u8 base = next_byte();
 			auto addr = (u8) (base + reg.x);
 			addrs[0] = create_address( read( addr ), read( (u8) (addr + 1) ) );
 			skip_cycles( 1, READ );
@@ -213,7 +676,7 @@ void CPU::exec( const u8 opcode )
 		}
 		case IndexedIndirectY:
 		{
-			u8 base = read( ++reg.pc );
+			u8 base = next_byte();
 			u16 addr = create_address( read( base ), read( (u8) (base + 1) ) );
 			addrs[0] = addr + reg.y;
 			if ( !same_page( addr, addrs[0] ) && page_sensitive || !page_sensitive )
@@ -223,7 +686,7 @@ void CPU::exec( const u8 opcode )
 			break;
 		}
 		case Relative:
-			offset = (i8) read( ++reg.pc );
+			offset = (i8) next_byte();
 			addrs[0] = reg.pc + 1 + offset;
 			break;
 		default:
@@ -232,10 +695,6 @@ void CPU::exec( const u8 opcode )
 
 	(*this.*curr_op.op_func)();
 
-	if constexpr( logging )
-	{
-		nes->out << setw( 30 ) << std::left << oss.str();
-	}
 	if ( inc_pc )
 	{
 		reg.pc++;
@@ -244,18 +703,55 @@ void CPU::exec( const u8 opcode )
 
 void CPU::set_status( const STATUS status, bool value )
 {
+	if ( status & (STATUS::n | STATUS::z) )
+	{
+		u8 p = get_p();
+		set_p( value ? p | status : p & ~status );
+		return;
+	}
 	reg.p = value ? reg.p | status : reg.p & ~status;
 }
 
 bool CPU::get_status( const STATUS status ) const
 {
-	return (reg.p & status) == status;
+	switch ( status )
+	{
+		case STATUS::z:
+			return (nz & 0xFF) == 0;
+		case STATUS::n:
+			return (nz & 0x180) != 0;
+		default:
+			return (reg.p & status) == status;
+	}
 }
 
 void CPU::set_value_status( const u8 val )
 {
-	set_status( STATUS::z, val == 0 );
-	set_status( STATUS::n, (bool) (val >> 7) );
+	nz = val;
+}
+
+u8 CPU::get_p() const
+{
+	u8 p = reg.p & ~(STATUS::n | STATUS::z);
+	if ( (nz & 0xFF) == 0 )
+	{
+		p |= STATUS::z;
+	}
+	if ( nz & 0x180 )
+	{
+		p |= STATUS::n;
+	}
+	return p;
+}
+
+void CPU::set_p( const u8 p )
+{
+	reg.p = p;
+	nz = p & STATUS::z ? 0 : 1;
+	if ( p & STATUS::n )
+	{
+		nz |= nz ? 0x80 : 0x100;
+	}
 }
 
 void CPU::push_stack( const u8 byte )
@@ -293,19 +789,8 @@ void CPU::branch( const STATUS status, const bool check_against )
 
 void CPU::compare( const u8 a, const u8 b )
 {
-	if ( a == b )
-	{
-		set_status( STATUS::n, false );
-		set_status( STATUS::z, true );
-		set_status( STATUS::c, true );
-	}
-	else
-	{
-		set_status( STATUS::z, false );
-		u8 diff = a - b;
-		set_status( STATUS::n, (bool) (diff >> 7) );
-		set_status( STATUS::c, a > b );
-	}
+	set_status( STATUS::c, a >= b );
+	set_value_status( a - b );
 }
 
 void CPU::push_address( const u16 addr )
@@ -427,9 +912,9 @@ void CPU::BEQ()
 void CPU::BIT()
 {
 	u8 test = oper();
-	set_status( STATUS::n, (bool) (test >> 7 & 1) );
 	set_status( STATUS::v, (bool) (test >> 6 & 1) );
-	set_status( STATUS::z, (bool) ((test & reg.acc) == 0) );
+	// N comes from the operand rather than the result, so it rides in bit 8
+	nz = (test & reg.acc) | (test & 0x80) << 1;
 }
 
 void CPU::BMI()
@@ -641,7 +1126,7 @@ void CPU::PHA()
 void CPU::PHP()
 {
 	skip_cycles( 1, READ );
-	push_stack( reg.p | STATUS::b );
+	push_stack( get_p() | STATUS::b );
 }
 
 void CPU::PLA()
@@ -659,7 +1144,7 @@ void CPU::PLP()
 	bool bit_5 = get_status( STATUS::bit_5 );
 
 	poll_interrupt();
-	reg.p = status;
+	set_p( status );
 	set_status( STATUS::b, b );
 	set_status( STATUS::bit_5, bit_5 );
 }
@@ -718,7 +1203,7 @@ void CPU::RTI()
 	u8 status = pop_stack();
 	bool b = get_status( STATUS::b );
 	bool bit_5 = get_status( STATUS::bit_5 );
-	reg.p = status;
+	set_p( status );
 	set_status( STATUS::b, b );
 	set_status( STATUS::bit_5, bit_5 );
 	reg.pc = pop_address();
@@ -841,11 +1326,36 @@ u8 CPU::read( int addr )
 }
 
 u8 CPU::read( int addr, bool physical_read )
+{
+	u8 data = read_bus( addr, physical_read );
+	if ( trace != nullptr )
+	{
+		trace->record_bus( Trace::READ, addr, data, cycle );
+	}
+	if ( cdl != nullptr )
+	{
+		cdl->mark_prg( rom_offset( addr ), CodeDataLog::DATA );
+	}
+	return data;
+}
+
+u8 CPU::read_bus( int addr, bool physical_read )
 {
 	if ( physical_read )
 	{
 		skip_cycles( 1, READ );
 	}
+	// RAM and ROM are a single load through the mapper's page table
+	if ( const u8 *page = mapper->cpu_read_page( addr ) )
+	{
+		return page[addr & Mapper::CPU_PAGE_MASK];
+	}
+	loop_clean = false;
+	if ( addr >= 0x2000 && addr < 0x4018 )
+	{
+		// Registers must see the PPU and APU as they are on this cycle
+		nes->catch_up();
+	}
 	if ( addr >= 0x2000 && addr <= 0x3FFF )
 	{
 		u8 ppureg = nes->get_ppu()->read_reg( addr % 8, cycle, physical_read );
@@ -859,6 +1369,10 @@ u8 CPU::read( int addr, bool physical_read )
 		}
 		else if ( addr == 0x4016 )
 		{
+			if ( memory_regs[0x16] & 0x1 )
+			{
+				nes->get_io()->poll();
+			}
 			return nes->get_io()->read_joy();
 		}
 		return memory_regs[addr - 0x4000];
@@ -876,6 +1390,20 @@ u8 CPU::read( int addr, bool physical_read )
 bool CPU::write( const u16 addr, const u8 data )
 {
 	skip_cycles( 1, WRITE );
+	loop_clean = false;
+	if ( trace != nullptr )
+	{
+		trace->record_bus( Trace::WRITE, addr, data, cycle );
+	}
+	if ( u8 *page = mapper->cpu_write_page( addr ) )
+	{
+		page[addr & Mapper::CPU_PAGE_MASK] = data;
+		return true;
+	}
+	if ( addr >= 0x2000 )
+	{
+		nes->catch_up();
+	}
 	if ( addr >= 0x2000 && addr <= 0x3FFF )
 	{
 		return nes->get_ppu()->write_reg( addr % 8, data, cycle, true );
@@ -890,6 +1418,11 @@ bool CPU::write( const u16 addr, const u8 data )
 	}
 	else if ( addr >= 0x4000 && addr < 0x4018 )
 	{
+		if ( addr == 0x4016 && ((memory_regs[0x16] | data) & 0x1) )
+		{
+			// The controllers keep reloading their buttons while the strobe is high
+			nes->get_io()->poll();
+		}
 		nes->get_apu()->write_apu_reg( addr - 0x4000, data );
 		memory_regs[addr - 0x4000] = data;
 	}
@@ -905,48 +1438,60 @@ bool CPU::write( const u16 addr, const u8 data )
 		}
 	}
 	mapper->handle_write( data, addr );
+	if ( addr >= 0x4000 )
+	{
+		// APU and mapper writes can bring an IRQ or DMC fetch forward
+		nes->update_horizon();
+	}
 	return true;
 }
 
 void CPU::dummy_write( const u16 addr, const u8 data )
 {
 	skip_cycles( 1, WRITE );
+	loop_clean = false;
+	if ( trace != nullptr )
+	{
+		trace->record_bus( Trace::WRITE, addr, data, cycle );
+	}
 	if ( addr >= 0x8000 )
 	{
+		nes->catch_up();
 		mapper->handle_write( data, addr );
+		nes->update_horizon();
 	}
 }
 
-void CPU::log_state()
-{
-	regs_log.str("");
-	regs_log.clear();
-	regs_log << "A:";
-	print_hex(regs_log, reg.acc);
-	regs_log << " X:";
-	print_hex(regs_log, reg.x);
-	regs_log << " Y:";
-	print_hex(regs_log, reg.y);
-	regs_log << " P:";
-	print_hex(regs_log, reg.p);
-	regs_log << " SP:";
-	print_hex(regs_log, reg.s);
-	regs_log << " CYC:" << cycle;
-	regs_log << " | PPU:";
-	for (int i = 0; i < 9; i++)
-	{
-		print_hex(regs_log, nes->get_ppu()->read_reg(i, cycle, false));
-		regs_log << " ";
-	}
-	regs_log << "CYC:" << nes->get_ppu()->get_y() << "," << nes->get_ppu()->get_x() << ":"
-		<< nes->get_ppu()->get_frame();
-	regs_log << " | v:";
-	print_hex(regs_log, nes->get_ppu()->get_v());
-	regs_log << " | t:";
-	print_hex(regs_log, nes->get_ppu()->get_t());
-	regs_log << " | w:";
-	print_hex(regs_log, nes->get_ppu()->get_w());
-	regs_log << " | x:";
-	print_hex(regs_log, nes->get_ppu()->get_finex());
-	nes->out << "\n";
+void CPU::trace_instruction()
+{
+	// The PPU has to be where it is on this cycle to report its position
+	nes->catch_up();
+	PPU *ppu = nes->get_ppu();
+	Trace::Record rec{};
+	rec.cycle = cycle;
+	rec.pc = reg.pc;
+	rec.scanline = ppu->get_y();
+	rec.dot = ppu->get_x();
+	rec.kind = Trace::INSTRUCTION;
+	// Peek at the instruction bytes without touching the bus; anything outside RAM and ROM shows as 0
+	for ( int i = 0; i < 3; i++ )
+	{
+		u16 addr = reg.pc + i;
+		const u8 *page = mapper->cpu_read_page( addr );
+		u8 byte = page == nullptr ? 0 : page[addr & Mapper::CPU_PAGE_MASK];
+		if ( i == 0 )
+		{
+			rec.opcode = byte;
+		}
+		else
+		{
+			rec.operands[i - 1] = byte;
+		}
+	}
+	rec.a = reg.acc;
+	rec.x = reg.x;
+	rec.y = reg.y;
+	rec.p = get_p();
+	rec.s = reg.s;
+	trace->record( rec );
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "util.h"
 #include "CPU.h"
 #include "PPU.h"
+#include "SaveState.h"
 
 #include <iostream>
 
@@ -46,7 +47,7 @@ bool Cartridge::read_next( Memory &into, const u32 start, const u32 bytes )
 	return false;
 }
 
-bool Cartridge::open_file( const nfdchar_t *filename )
+bool Cartridge::open_file( const char *filename )
 {
 	pos = 0;
 	nes->out << "===== " << filename << " =====\n\n";
@@ -175,48 +176,52 @@ bool Cartridge::load()
 		{
 			chr_rom.init( chr_size );
 			read_next( chr_rom, 0, chr_size );
+			tiles.init( chr_rom.get_mem(), chr_size );
 		}
 		else
 		{
 			chr_ram.init( chr_ram_size );
+			tiles.init( chr_ram.get_mem(), chr_ram_size );
 		}
 
 		nt_ram.init( 0x800 );
 
+		cdl.init( prg_size, chr_size );
+
 		CPU *cpu = nes->get_cpu();
 		PPU *ppu = nes->get_ppu();
 
 		switch ( mapper_num )
 		{
 			case 0:
-				mapper = new Mapper( this );
+				mapper = Mapper::create< Mapper >( this );
 				break;
 			case 1:
-				mapper = new Mapper1( this );
+				mapper = Mapper::create< Mapper1 >( this );
 				break;
 			case 2:
-				mapper = new Mapper2( this );
+				mapper = Mapper::create< Mapper2 >( this );
 				break;
 			case 3:
-				mapper = new Mapper3( this );
+				mapper = Mapper::create< Mapper3 >( this );
 				break;
 			case 4:
-				mapper = new Mapper4( this );
+				mapper = Mapper::create< Mapper4 >( this );
 				break;
 			case 7:
-				mapper = new Mapper7( this );
+				mapper = Mapper::create< Mapper7 >( this );
 				break;
 			case 11:
-				mapper = new Mapper11( this );
+				mapper = Mapper::create< Mapper11 >( this );
 				break;
 			case 69:
-				mapper = new Mapper69( this );
+				mapper = Mapper::create< Mapper69 >( this );
 				break;
 			case 184:
-				mapper = new Mapper184( this );
+				mapper = Mapper::create< Mapper184 >( this );
 				break;
 			case 228:
-				mapper = new Mapper228( this );
+				mapper = Mapper::create< Mapper228 >( this );
 				break;
 			default:
 				err = CartError::MAPPER;
@@ -233,6 +238,8 @@ bool Cartridge::load()
 			mapper->set_mirroring( static_cast<MIRRORING>(flags[0][0]) );
 		}
 
+		mapper->update_cpu_pages();
+		mapper->update_ppu_pages();
 		cpu->set_mapper( mapper );
 		ppu->set_mapper( mapper );
 
@@ -286,6 +293,38 @@ void Cartridge::dump_sram()
 	}
 }
 
+void Cartridge::serialize( SaveState &save )
+{
+	save.io( prg_ram );
+	save.io( chr_ram );
+	save.io( nt_ram );
+	mapper->serialize( save );
+	if ( save.is_loading() )
+	{
+		if ( chr_size == 0 )
+		{
+			tiles.rebuild();
+		}
+		mapper->update_cpu_pages();
+		mapper->update_ppu_pages();
+	}
+}
+
+bool Cartridge::load_cdl()
+{
+	return cdl.load( "NESP_Saves/" + nes->filename + ".cdl" );
+}
+
+void Cartridge::dump_cdl()
+{
+	// Nothing is loaded yet
+	if ( prg_size == 0 )
+	{
+		return;
+	}
+	cdl.save( "NESP_Saves/" + nes->filename + ".cdl" );
+}
+
 void Cartridge::load_sram()
 {
 	if ( battery_ram )
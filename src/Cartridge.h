@@ -6,6 +6,8 @@
 #include <vector>
 #include "Memory.h"
 #include "Component.h"
+#include "CodeDataLog.h"
+#include "TileCache.h"
 
 enum class CartError
 {
@@ -18,6 +20,8 @@ enum class CartError
 
 class Mapper;
 
+class SaveState;
+
 class Cartridge : public Component
 {
 public:
@@ -29,7 +33,7 @@ public:
 
 	bool load();
 
-	bool open_file( const nfdchar_t *filename );
+	bool open_file( const char *filename );
 
 	std::ifstream &get_file()
 	{
@@ -46,6 +50,11 @@ public:
 		return chr_size == 0 ? chr_ram_size : chr_size;
 	}
 
+	u16 get_mapper_num() const
+	{
+		return mapper_num;
+	}
+
 	Memory *get_prg_rom()
 	{
 		return &prg_rom;
@@ -78,6 +87,24 @@ public:
 
 	void dump_sram();
 
+	TileCache *get_tile_cache()
+	{
+		return &tiles;
+	}
+
+	CodeDataLog *get_cdl()
+	{
+		return &cdl;
+	}
+
+	// The code/data log is kept in NESP_Saves/<rom>.cdl; loading adds to what has been logged so far
+	bool load_cdl();
+
+	void dump_cdl();
+
+	// Cartridge RAM and the mapper's registers
+	void serialize( SaveState &save );
+
 	std::string get_error();
 
 private:
@@ -112,6 +139,10 @@ private:
 
 	Memory nt_ram;
 
+	TileCache tiles;
+
+	CodeDataLog cdl;
+
 	bool battery_ram = false;
 
 	CartError err = CartError::NONE;
@@ -0,0 +1,96 @@
+#include "CodeDataLog.h"
+
+#include <bit>
+#include <fstream>
+#include <iterator>
+
+void CodeDataLog::init( size_t prg, size_t chr )
+{
+	prg_size = prg;
+	chr_size = chr;
+	size_t prg_words = (prg + 63) / 64;
+	size_t chr_words = (chr + 63) / 64;
+	prg_code.assign( prg_words, 0 );
+	prg_data.assign( prg_words, 0 );
+	prg_dmc.assign( prg_words, 0 );
+	chr_rendered.assign( chr_words, 0 );
+	chr_read.assign( chr_words, 0 );
+}
+
+size_t CodeDataLog::count( const std::vector< u64 > &bits )
+{
+	size_t n = 0;
+	for ( u64 word : bits )
+	{
+		n += std::popcount( word );
+	}
+	return n;
+}
+
+size_t CodeDataLog::count( PrgUsage usage ) const
+{
+	return count( usage == CODE ? prg_code : usage == DATA ? prg_data : prg_dmc );
+}
+
+size_t CodeDataLog::count( ChrUsage usage ) const
+{
+	return count( usage == RENDERED ? chr_rendered : chr_read );
+}
+
+bool CodeDataLog::save( const std::string &path ) const
+{
+	std::vector< u8 > flags( prg_size + chr_size );
+	for ( size_t i = 0; i < prg_size; i++ )
+	{
+		flags[i] = (get( prg_code, i ) ? CODE : 0) | (get( prg_data, i ) ? DATA : 0) | (get( prg_dmc, i ) ? DMC : 0);
+	}
+	for ( size_t i = 0; i < chr_size; i++ )
+	{
+		flags[prg_size + i] = (get( chr_rendered, i ) ? RENDERED : 0) | (get( chr_read, i ) ? READ : 0);
+	}
+	std::ofstream file( path, std::ios::binary );
+	file.write( (const char *)flags.data(), flags.size() );
+	return file.good();
+}
+
+bool CodeDataLog::load( const std::string &path )
+{
+	std::ifstream file( path, std::ios::binary );
+	if ( !file.good() )
+	{
+		return false;
+	}
+	std::vector< u8 > flags( (std::istreambuf_iterator< char >( file )), std::istreambuf_iterator< char >() );
+	if ( flags.size() != prg_size + chr_size )
+	{
+		return false;
+	}
+	// Bits other .cdl writers keep, such as which CPU window a byte was mapped into, are dropped
+	for ( size_t i = 0; i < prg_size; i++ )
+	{
+		if ( flags[i] & CODE )
+		{
+			set( prg_code, i );
+		}
+		if ( flags[i] & DATA )
+		{
+			set( prg_data, i );
+		}
+		if ( flags[i] & DMC )
+		{
+			set( prg_dmc, i );
+		}
+	}
+	for ( size_t i = 0; i < chr_size; i++ )
+	{
+		if ( flags[prg_size + i] & RENDERED )
+		{
+			set( chr_rendered, i );
+		}
+		if ( flags[prg_size + i] & READ )
+		{
+			set( chr_read, i );
+		}
+	}
+	return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "BitUtils.h"
+
+// Code/data log: a bitmap per kind of use over every byte of PRG and CHR ROM, recording which bytes have been
+// run as code, read as data, played as DMC samples, drawn by the PPU or read through $2007. Files use the
+// FCEUX .cdl layout, a byte of flags per PRG ROM byte followed by one per CHR ROM byte
+class CodeDataLog
+{
+public:
+	// The bit values are the ones .cdl files use
+	enum PrgUsage : u8
+	{
+		CODE = 0x01, DATA = 0x02, DMC = 0x40
+	};
+
+	enum ChrUsage : u8
+	{
+		RENDERED = 0x01, READ = 0x02
+	};
+
+	// Sizes the bitmaps for a ROM and clears them. chr_size is 0 for a cartridge with CHR RAM
+	void init( size_t prg_size, size_t chr_size );
+
+	// Offsets outside the ROM, such as the -1 Mapper::prg_rom_offset() gives for RAM, are ignored
+	void mark_prg( long offset, PrgUsage usage )
+	{
+		if ( (size_t)offset < prg_size )
+		{
+			set( usage == CODE ? prg_code : usage == DATA ? prg_data : prg_dmc, offset );
+		}
+	}
+
+	void mark_prg( long offset, int length, PrgUsage usage )
+	{
+		for ( int i = 0; i < length && offset >= 0; i++ )
+		{
+			mark_prg( offset + i, usage );
+		}
+	}
+
+	void mark_chr( long offset, ChrUsage usage )
+	{
+		if ( (size_t)offset < chr_size )
+		{
+			set( usage == RENDERED ? chr_rendered : chr_read, offset );
+		}
+	}
+
+	bool is_code( long offset ) const
+	{
+		return (size_t)offset < prg_size && (prg_code[offset >> 6] >> (offset & 63) & 1);
+	}
+
+	// How many bytes have been seen used that way
+	size_t count( PrgUsage usage ) const;
+
+	size_t count( ChrUsage usage ) const;
+
+	bool save( const std::string &path ) const;
+
+	// Adds what a .cdl file for the same ROM has logged; false if there is none or it doesn't fit the ROM
+	bool load( const std::string &path );
+
+private:
+	static void set( std::vector< u64 > &bits, size_t i )
+	{
+		bits[i >> 6] |= (u64)1 << (i & 63);
+	}
+
+	static bool get( const std::vector< u64 > &bits, size_t i )
+	{
+		return bits[i >> 6] >> (i & 63) & 1;
+	}
+
+	static size_t count( const std::vector< u64 > &bits );
+
+	size_t prg_size = 0;
+	size_t chr_size = 0;
+	std::vector< u64 > prg_code;
+	std::vector< u64 > prg_data;
+	std::vector< u64 > prg_dmc;
+	std::vector< u64 > chr_rendered;
+	std::vector< u64 > chr_read;
+};
@@ -0,0 +1,201 @@
+#include "Compositor.h"
+
+#include <algorithm>
+
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+#define COMPOSITOR_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit vector instructions in functions marked for them; MSVC always can
+#if defined( __GNUC__ )
+#define TARGET( isa ) __attribute__(( target( isa ) ))
+#else
+#define TARGET( isa )
+#endif
+
+// Composes pixels [px, run.end) one at a time; also the tail of the vector versions
+static bool compose_scalar( const Compositor::Run &run, int px )
+{
+	bool hit = false;
+	for ( ; px < run.end; px++ )
+	{
+		u8 bgr_key = run.bgr[px];
+		u8 spr = px >= run.spr_from ? run.spr[px] : 0;
+		u8 key = bgr_key;
+		if ( (spr & 0x3) != 0 )
+		{
+			// Keys are offsets from $3F00, with 0 being the backdrop color
+			if ( bgr_key == 0 || (spr & Compositor::SPR_FRONT) != 0 )
+			{
+				key = 0x10 | (spr & 0xF);
+			}
+			if ( bgr_key != 0 && (spr & Compositor::SPR_ZERO) != 0 )
+			{
+				hit = true;
+			}
+		}
+		run.out[px] = run.colors[key] | run.emphasis;
+	}
+	return hit;
+}
+
+static bool compose_scalar( const Compositor::Run &run )
+{
+	return compose_scalar( run, run.start );
+}
+
+#ifdef COMPOSITOR_X86
+TARGET( "sse4.1" )
+static bool compose_sse41( const Compositor::Run &run )
+{
+	const __m128i colors_lo = _mm_loadu_si128( (const __m128i *)run.colors );
+	const __m128i colors_hi = _mm_loadu_si128( (const __m128i *)(run.colors + 16) );
+	const __m128i emphasis = _mm_set1_epi16( (short)run.emphasis );
+	const __m128i spr_from = _mm_set1_epi8( (char)std::min( run.spr_from, 255 ) );
+	const __m128i lane = _mm_setr_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+	const __m128i zero = _mm_setzero_si128();
+	const bool spr_off = run.spr_from > 255;
+	__m128i hits = zero;
+
+	int px = run.start;
+	for ( ; px + 16 <= run.end; px += 16 )
+	{
+		__m128i bgr = _mm_loadu_si128( (const __m128i *)(run.bgr + px) );
+		__m128i spr = spr_off ? zero : _mm_loadu_si128( (const __m128i *)(run.spr + px) );
+		// Unsigned x >= spr_from, for the pixels sprites show at
+		__m128i x = _mm_add_epi8( _mm_set1_epi8( (char)px ), lane );
+		__m128i shown = _mm_cmpeq_epi8( _mm_max_epu8( x, spr_from ), x );
+
+		__m128i opaque = _mm_andnot_si128( _mm_cmpeq_epi8( _mm_and_si128( spr, _mm_set1_epi8( 0x3 ) ), zero ), shown );
+		__m128i front = _mm_cmpeq_epi8( _mm_and_si128( spr, _mm_set1_epi8( Compositor::SPR_FRONT ) ),
+		                                _mm_set1_epi8( Compositor::SPR_FRONT ) );
+		__m128i bgr_clear = _mm_cmpeq_epi8( bgr, zero );
+		__m128i use_spr = _mm_and_si128( opaque, _mm_or_si128( bgr_clear, front ) );
+		__m128i spr_key = _mm_or_si128( _mm_and_si128( spr, _mm_set1_epi8( 0xF ) ), _mm_set1_epi8( 0x10 ) );
+		__m128i key = _mm_blendv_epi8( bgr, spr_key, use_spr );
+
+		__m128i zero_spr = _mm_cmpeq_epi8( _mm_and_si128( spr, _mm_set1_epi8( Compositor::SPR_ZERO ) ),
+		                                   _mm_set1_epi8( Compositor::SPR_ZERO ) );
+		hits = _mm_or_si128( hits, _mm_andnot_si128( bgr_clear, _mm_and_si128( opaque, zero_spr ) ) );
+
+		// Keys are below 32: bit 4 picks the half of the palette, shifted up into the byte's sign bit for blendv
+		__m128i col = _mm_blendv_epi8( _mm_shuffle_epi8( colors_lo, key ), _mm_shuffle_epi8( colors_hi, key ),
+		                               _mm_slli_epi16( key, 3 ) );
+		_mm_storeu_si128( (__m128i *)(run.out + px), _mm_or_si128( _mm_cvtepu8_epi16( col ), emphasis ) );
+		_mm_storeu_si128( (__m128i *)(run.out + px + 8),
+		                  _mm_or_si128( _mm_cvtepu8_epi16( _mm_srli_si128( col, 8 ) ), emphasis ) );
+	}
+	return compose_scalar( run, px ) | (_mm_movemask_epi8( hits ) != 0);
+}
+
+TARGET( "avx2" )
+static bool compose_avx2( const Compositor::Run &run )
+{
+	const __m256i colors_lo = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i *)run.colors ) );
+	const __m256i colors_hi = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i *)(run.colors + 16) ) );
+	const __m256i emphasis = _mm256_set1_epi16( (short)run.emphasis );
+	const __m256i spr_from = _mm256_set1_epi8( (char)std::min( run.spr_from, 255 ) );
+	const __m256i lane = _mm256_setr_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
+	                                       21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31 );
+	const __m256i zero = _mm256_setzero_si256();
+	const bool spr_off = run.spr_from > 255;
+	__m256i hits = zero;
+
+	int px = run.start;
+	for ( ; px + 32 <= run.end; px += 32 )
+	{
+		__m256i bgr = _mm256_loadu_si256( (const __m256i *)(run.bgr + px) );
+		__m256i spr = spr_off ? zero : _mm256_loadu_si256( (const __m256i *)(run.spr + px) );
+		__m256i x = _mm256_add_epi8( _mm256_set1_epi8( (char)px ), lane );
+		__m256i shown = _mm256_cmpeq_epi8( _mm256_max_epu8( x, spr_from ), x );
+
+		__m256i opaque = _mm256_andnot_si256( _mm256_cmpeq_epi8( _mm256_and_si256( spr, _mm256_set1_epi8( 0x3 ) ), zero ),
+		                                      shown );
+		__m256i front = _mm256_cmpeq_epi8( _mm256_and_si256( spr, _mm256_set1_epi8( Compositor::SPR_FRONT ) ),
+		                                   _mm256_set1_epi8( Compositor::SPR_FRONT ) );
+		__m256i bgr_clear = _mm256_cmpeq_epi8( bgr, zero );
+		__m256i use_spr = _mm256_and_si256( opaque, _mm256_or_si256( bgr_clear, front ) );
+		__m256i spr_key = _mm256_or_si256( _mm256_and_si256( spr, _mm256_set1_epi8( 0xF ) ), _mm256_set1_epi8( 0x10 ) );
+		__m256i key = _mm256_blendv_epi8( bgr, spr_key, use_spr );
+
+		__m256i zero_spr = _mm256_cmpeq_epi8( _mm256_and_si256( spr, _mm256_set1_epi8( Compositor::SPR_ZERO ) ),
+		                                      _mm256_set1_epi8( Compositor::SPR_ZERO ) );
+		hits = _mm256_or_si256( hits, _mm256_andnot_si256( bgr_clear, _mm256_and_si256( opaque, zero_spr ) ) );
+
+		// The shuffles look up within each 128-bit half, so both halves hold the whole table
+		__m256i col = _mm256_blendv_epi8( _mm256_shuffle_epi8( colors_lo, key ), _mm256_shuffle_epi8( colors_hi, key ),
+		                                  _mm256_slli_epi16( key, 3 ) );
+		_mm256_storeu_si256( (__m256i *)(run.out + px),
+		                     _mm256_or_si256( _mm256_cvtepu8_epi16( _mm256_castsi256_si128( col ) ), emphasis ) );
+		_mm256_storeu_si256( (__m256i *)(run.out + px + 16),
+		                     _mm256_or_si256( _mm256_cvtepu8_epi16( _mm256_extracti128_si256( col, 1 ) ), emphasis ) );
+	}
+	return compose_scalar( run, px ) | (_mm256_movemask_epi8( hits ) != 0);
+}
+#endif
+
+Compositor::ComposeFn Compositor::compose_fn = compose_scalar;
+Compositor::Isa Compositor::isa = SCALAR;
+[[maybe_unused]] static const Compositor::Isa initial_isa = Compositor::select( Compositor::detect() );
+
+Compositor::Isa Compositor::detect()
+{
+#if defined( COMPOSITOR_X86 ) && defined( __GNUC__ )
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports( "avx2" ) )
+	{
+		return AVX2;
+	}
+	if ( __builtin_cpu_supports( "sse4.1" ) )
+	{
+		return SSE41;
+	}
+#elif defined( COMPOSITOR_X86 ) && defined( _MSC_VER )
+	int info[4];
+	__cpuid( info, 1 );
+	bool sse41 = info[2] & (1 << 19);
+	// AVX2 also needs the OS to save the YMM registers
+	bool os_ymm = (info[2] & (1 << 27)) && (_xgetbv( 0 ) & 0x6) == 0x6;
+	__cpuidex( info, 7, 0 );
+	if ( os_ymm && (info[1] & (1 << 5)) )
+	{
+		return AVX2;
+	}
+	if ( sse41 )
+	{
+		return SSE41;
+	}
+#endif
+	return SCALAR;
+}
+
+Compositor::Isa Compositor::select( Isa wanted )
+{
+	isa = std::min( wanted, detect() );
+	switch ( isa )
+	{
+#ifdef COMPOSITOR_X86
+		case AVX2:
+			compose_fn = compose_avx2;
+			break;
+		case SSE41:
+			compose_fn = compose_sse41;
+			break;
+#endif
+		default:
+			isa = SCALAR;
+			compose_fn = compose_scalar;
+			break;
+	}
+	return isa;
+}
+
+const char *Compositor::name( Isa isa )
+{
+	static const char *NAMES[] = { "scalar", "sse4.1", "avx2" };
+	return NAMES[isa];
+}
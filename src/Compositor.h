@@ -0,0 +1,60 @@
+#pragma once
+
+#include "BitUtils.h"
+
+// The last step of drawing a scanline: multiplexing background and sprite pixels by priority, testing for a
+// sprite 0 hit, masking sprites out of the left 8 pixels and looking up palette colors. Vector versions run
+// 16 or 32 pixels at a time on CPUs that have SSE4.1 or AVX2, and give exactly what the scalar one does
+class Compositor
+{
+public:
+	enum Isa : u8
+	{
+		SCALAR, SSE41, AVX2
+	};
+
+	// One run of pixels of a line, in the PPU's line buffers
+	struct Run
+	{
+		// Background palette offsets, 0 where transparent, and pre-decoded sprite pixels as PPU::spr_line holds them
+		const u8 *bgr;
+		const u8 *spr;
+		int start;
+		int end;
+		// First pixel sprites show at: 0, 8 when they are masked out of the left edge, or 256 when they are off
+		int spr_from;
+		// Color for each palette offset, grayscale applied, and the emphasis bits to add to every pixel
+		const u8 *colors;
+		u16 emphasis;
+		u16 *out;
+	};
+
+	// Draws the run, and returns whether an opaque sprite 0 pixel landed on an opaque background pixel
+	static bool compose( const Run &run )
+	{
+		return compose_fn( run );
+	}
+
+	// The widest the host CPU supports
+	static Isa detect();
+
+	// Composes with isa from now on, or the widest the host supports below it; returns the one picked
+	static Isa select( Isa isa );
+
+	static Isa get_isa()
+	{
+		return isa;
+	}
+
+	static const char *name( Isa isa );
+
+	// Values SPR_FRONT and SPR_ZERO take in PPU::spr_line
+	static constexpr u8 SPR_FRONT = 0x10;
+	static constexpr u8 SPR_ZERO = 0x20;
+
+private:
+	typedef bool (*ComposeFn)( const Run &run );
+
+	static ComposeFn compose_fn;
+	static Isa isa;
+};
@@ -373,17 +373,24 @@ bool Display::update_apu()
 
 bool Display::refresh()
 {
-	int texture_pitch = 0;
-	void *texture_pixels = nullptr;
-	if ( SDL_LockTexture( texture_game, nullptr, &texture_pixels, &texture_pitch ) != 0 )
-	{
-		SDL_Log( "Unable to lock texture: %s", SDL_GetError() );
-	}
-	else
+	// Only upload when the PPU has handed over a new frame since the last refresh
+	FrameBuffer *frame_buffer = nes->get_frame_buffer();
+	long frames_pushed = frame_buffer->get_frames_pushed();
+	if ( frames_pushed != shown_frame )
 	{
-		memcpy( texture_pixels, pixels, texture_pitch * HEIGHT );
+		int texture_pitch = 0;
+		void *texture_pixels = nullptr;
+		if ( SDL_LockTexture( texture_game, nullptr, &texture_pixels, &texture_pitch ) != 0 )
+		{
+			SDL_Log( "Unable to lock texture: %s", SDL_GetError() );
+		}
+		else
+		{
+			memcpy( texture_pixels, frame_buffer->get_pixels(), texture_pitch * HEIGHT );
+			shown_frame = frames_pushed;
+		}
+		SDL_UnlockTexture( texture_game );
 	}
-	SDL_UnlockTexture( texture_game );
 
 	SDL_RenderClear( renderer_main );
 	SDL_SetRenderTarget( renderer_main, texture_main_base );
@@ -420,16 +427,6 @@ void Display::set_show_sys_texture( bool show )
 	show_sys_texture = show;
 }
 
-void Display::black()
-{
-	for ( int p = 0; p < WIDTH * HEIGHT * 3; p += 3 )
-	{
-		pixels[p] = 0;
-		pixels[p + 1] = 0;
-		pixels[p + 2] = 0;
-	}
-}
-
 void Display::close()
 {
 	SDL_DestroyTexture( texture_game );
@@ -445,23 +442,6 @@ void Display::close()
 	SDL_Quit();
 }
 
-void Display::set_pixel_buffer( u8 x, u8 y, const u8 rgb[3] )
-{
-	buffer[(x + (y * WIDTH)) * 3] = rgb[0];
-	buffer[(x + (y * WIDTH)) * 3 + 1] = rgb[1];
-	buffer[(x + (y * WIDTH)) * 3 + 2] = rgb[2];
-}
-
-void Display::push_buffer()
-{
-	//black();
-	for ( int p = 0; p < WIDTH * HEIGHT * 3; p++ )
-	{
-		pixels[p] = buffer[p];
-		buffer[p] = 0;
-	}
-}
-
 void Display::write_pt_pixel( u8 tile, u8 x, u8 y, bool pt2, const u8 rgb[3] )
 {
 	int index = (128 * pt2 + 256 * 8 * (tile / 16) + 8 * (tile % 16) + x + 256 * y) * 3;
@@ -7,9 +7,7 @@
 #include <SDL.h>
 #include "BitUtils.h"
 #include "Component.h"
-
-#define WIDTH 256
-#define HEIGHT 240
+#include "FrameBuffer.h"
 
 class SoundChip;
 
@@ -37,10 +35,6 @@ public:
 
 	void close();
 
-	void black();
-
-	void set_pixel_buffer( u8 x, u8 y, const u8 rgb[3] );
-
 	void write_pt_pixel( u8 tile, u8 x, u8 y, bool pt2, const u8 rgb[3] );
 
 	void write_nt_pixel( int tile, u8 x, u8 y, short nt, const u8 rgb[3] );
@@ -53,13 +47,6 @@ public:
 
 	void on_right_clicked( int y );
 
-	void push_buffer();
-
-	u8 *get_pixels()
-	{
-		return pixels;
-	}
-
 	void set_show_sys_texture( bool show );
 
 	void set_show_window( SDL_Window *window, bool show )
@@ -131,6 +118,7 @@ public:
 
 public:
 	u32 last_update = 0;
+	long shown_frame = -1;
 	bool *apu_debug_muted = new bool[5] { false };
 
 private:
@@ -223,9 +211,6 @@ private:
 
 	void reinit_apu_window();
 
-	u8 pixels[WIDTH * HEIGHT * 3] = { 0 };
-	u8 buffer[WIDTH * HEIGHT * 3] = { 0 };
-
 	u8 pt[256 * 128 * 3] = { 0 };
 	u8 nts[256 * 240 * 4 * 3] = { 0 };
 
@@ -0,0 +1,95 @@
+#include "FrameBuffer.h"
+#include <algorithm>
+#include <cstring>
+
+FrameBuffer::FrameBuffer()
+{
+	std::fill( frames[0], frames[0] + WIDTH * HEIGHT, PIXEL_BLANK );
+	std::fill( frames[1], frames[1] + WIDTH * HEIGHT, PIXEL_BLANK );
+}
+
+void FrameBuffer::push( const u8 palette[64][3] )
+{
+	if ( frames_pushed == 0 || memcmp( palette, lut_palette, sizeof lut_palette ) != 0 )
+	{
+		build_lut( palette );
+	}
+
+	std::swap( front, back );
+	pixels_stale = true;
+	frames_pushed.fetch_add( 1, std::memory_order_release );
+}
+
+u8 *FrameBuffer::get_pixels()
+{
+	if ( pixels_stale )
+	{
+		// One table lookup per pixel, done once a frame instead of per dot
+		u8 *out = pixels;
+		for ( int p = 0; p < WIDTH * HEIGHT; p++, out += 3 )
+		{
+			const u8 *rgb = lut[front[p]];
+			out[0] = rgb[0];
+			out[1] = rgb[1];
+			out[2] = rgb[2];
+		}
+		pixels_stale = false;
+	}
+	return pixels;
+}
+
+void FrameBuffer::build_lut( const u8 palette[64][3] )
+{
+	memcpy( lut_palette, palette, sizeof lut_palette );
+	for ( int emphasis = 0; emphasis < 8; emphasis++ )
+	{
+		for ( int col = 0; col < 64; col++ )
+		{
+			u8 *rgb = lut[(emphasis << PIXEL_EMPHASIS_SHIFT) | col];
+			std::copy( palette[col], palette[col] + 3, rgb );
+			if ( emphasis & 0x1 )
+			{
+				rgb[1] *= 0.85;
+				rgb[2] *= 0.85;
+			}
+			if ( emphasis & 0x2 )
+			{
+				rgb[0] *= 0.85;
+				rgb[2] *= 0.85;
+			}
+			if ( emphasis & 0x4 )
+			{
+				rgb[0] *= 0.85;
+				rgb[1] *= 0.85;
+			}
+		}
+	}
+	std::fill( lut[PIXEL_BLANK], lut[PIXEL_BLANK] + 3, 0 );
+}
+
+void FrameBuffer::black()
+{
+	pixels_stale = false;
+	for ( int p = 0; p < WIDTH * HEIGHT * 3; p += 3 )
+	{
+		pixels[p] = 0;
+		pixels[p + 1] = 0;
+		pixels[p + 2] = 0;
+	}
+}
+
+u64 FrameBuffer::hash() const
+{
+	// 64-bit FNV-1a over the RGB of the last completed frame, read through the table so no conversion is needed
+	u64 h = 0xCBF29CE484222325;
+	for ( int p = 0; p < WIDTH * HEIGHT; p++ )
+	{
+		const u8 *rgb = lut[front[p]];
+		for ( int c = 0; c < 3; c++ )
+		{
+			h ^= rgb[c];
+			h *= 0x100000001B3;
+		}
+	}
+	return h;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "BitUtils.h"
+#include <atomic>
+
+#define WIDTH 256
+#define HEIGHT 240
+
+// Pixels are stored as a 6-bit palette index with the 3 PPUMASK emphasis bits above it
+#define PIXEL_EMPHASIS_SHIFT 6
+#define PIXEL_BLANK 0x200
+
+class FrameBuffer
+{
+public:
+	FrameBuffer();
+
+	~FrameBuffer() = default;
+
+	// The PPU writes every visible pixel of every frame, so the back buffer never needs clearing
+	void set_pixel( u8 x, u8 y, u16 index )
+	{
+		back[x + y * WIDTH] = index;
+	}
+
+	// Hands the completed back buffer over as the new front buffer, to be shown with the given master palette
+	void push( const u8 palette[64][3] );
+
+	void black();
+
+	// RGB of the front buffer, converted on first use after each push
+	u8 *get_pixels();
+
+	// Row y of the back buffer, for drawing a run of pixels at once
+	u16 *get_row( u8 y )
+	{
+		return back + y * WIDTH;
+	}
+
+	const u16 *get_indices() const
+	{
+		return front;
+	}
+
+	u64 hash() const;
+
+	// Consumers compare this against the last frame they took to see whether a new one is ready
+	long get_frames_pushed() const
+	{
+		return frames_pushed.load( std::memory_order_acquire );
+	}
+
+private:
+	void build_lut( const u8 palette[64][3] );
+
+	u16 frames[2][WIDTH * HEIGHT];
+	u16 *front = frames[0];
+	u16 *back = frames[1];
+
+	u8 pixels[WIDTH * HEIGHT * 3] = { 0 };
+	bool pixels_stale = false;
+
+	// RGB for every index and emphasis combination, plus black for pixels never drawn
+	u8 lut[PIXEL_BLANK + 1][3] = { };
+	u8 lut_palette[64][3] = { };
+
+	std::atomic<long> frames_pushed = 0;
+};
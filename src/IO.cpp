@@ -1,7 +1,9 @@
 #include "IO.h"
+#include "SaveState.h"
 
 void IO::poll()
 {
+#ifndef NESPRIME_HEADLESS
 	auto *keystate = const_cast<Uint8 *>(SDL_GetKeyboardState( nullptr ));
 	for ( int k = 0; k < 8; k++ )
 	{
@@ -18,6 +20,11 @@ void IO::poll()
 			}
 		}
 	}
+#else
+	// No keyboard to read from, so the controllers are always idle
+	joy_status[ 0 ] = 0;
+	joy_status[ 1 ] = 0;
+#endif
 }
 
 bool IO::read_joy()
@@ -28,4 +35,9 @@ bool IO::read_joy()
 	SET_BIT( joy_status[ 0 ], 7 );
 
 	return val;
+}
+
+void IO::serialize( SaveState &save )
+{
+	save.io( joy_status );
 }
\ No newline at end of file
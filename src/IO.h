@@ -2,7 +2,11 @@
 
 #include "BitUtils.h"
 #include "Component.h"
+#ifndef NESPRIME_HEADLESS
 #include <SDL.h>
+#endif
+
+class SaveState;
 
 enum KEY
 {
@@ -16,10 +20,14 @@ public:
 
 	bool read_joy();
 
+	void serialize( SaveState &save );
+
 private:
+#ifndef NESPRIME_HEADLESS
 	constexpr static SDL_Scancode bindings[8] = {
 			SDL_SCANCODE_Z, SDL_SCANCODE_X, SDL_SCANCODE_TAB, SDL_SCANCODE_RETURN,
 			SDL_SCANCODE_UP, SDL_SCANCODE_DOWN, SDL_SCANCODE_LEFT, SDL_SCANCODE_RIGHT
 	};
+#endif
 	u8 joy_status[ 2 ] = { 0 };
 };
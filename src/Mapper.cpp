@@ -1,5 +1,6 @@
 #include "Mapper.h"
 #include "APU/SoundChip.h"
+#include "SaveState.h"
 
 Mapper::Mapper( Cartridge *cart ) : cartridge( cart )
 {
@@ -12,6 +13,7 @@ Mapper::Mapper( Cartridge *cart ) : cartridge( cart )
 	prg_ram = cartridge->get_prg_ram()->get_mem();
 	chr_ram = cartridge->get_chr_ram()->get_mem();
 	nt_ram = cartridge->get_nt_ram()->get_mem();
+	tiles = cartridge->get_tile_cache();
 	mirroring = Horizontal;
 }
 
@@ -41,6 +43,37 @@ u8 *Mapper::map_cpu( u16 addr )
 	}
 }
 
+void Mapper::update_cpu_pages()
+{
+	u8 *prg_ram_end = prg_ram + cartridge->get_prg_ram()->get_size();
+	for ( int page = 0; page < CPU_PAGES; page++ )
+	{
+		u16 addr = page << CPU_PAGE_SHIFT;
+		u8 *mem = nullptr;
+		if ( addr < 0x2000 || addr >= 0x8000 || (addr >= 0x6000 && has_prg_ram()) )
+		{
+			mem = map_cpu( addr );
+		}
+		cpu_read_pages[ page ] = mem;
+
+		// Stores to ROM are left to the slow path, which hands them to handle_write()
+		bool ram = addr < 0x2000 || (mem >= prg_ram && mem < prg_ram_end);
+		cpu_write_pages[ page ] = ram ? mem : nullptr;
+	}
+}
+
+void Mapper::update_ppu_pages()
+{
+	for ( int page = 0; page < PPU_PAGES; page++ )
+	{
+		ppu_pages[ page ] = map_ppu( page << PPU_PAGE_SHIFT );
+	}
+	for ( int page = 0; page < 0x2000 >> PPU_PAGE_SHIFT; page++ )
+	{
+		tile_pages[ page ] = tiles->page( ppu_pages[ page ] );
+	}
+}
+
 u8 *Mapper::map_ppu( u16 addr )
 {
 	if ( addr >= 0x3F00 )
@@ -77,6 +110,15 @@ u8 *Mapper::map_ppu( u16 addr )
 	}
 }
 
+void Mapper::serialize( SaveState &save )
+{
+	save.io( mirroring );
+	save.io( bank_prg );
+	save.io( bank_chr );
+	save.io( irq_pending );
+	save.io( irq_disable );
+}
+
 // === MAPPER 1 (MMC1) ===
 
 u8 *Mapper1::map_cpu( u16 address )
@@ -149,6 +191,7 @@ void Mapper1::handle_write( u8 data, u16 addr )
 		shifter = 0x80;
 		bankmode_prg = 3;
 		last_write = cyc;
+		update_cpu_pages();
 		return;
 	} // clear the shift register if bit 7 is set
 
@@ -204,12 +247,25 @@ void Mapper1::handle_write( u8 data, u16 addr )
 			}
 
 			shifter = 0x80;
+			update_cpu_pages();
+			update_ppu_pages();
 		}
 	}
 
 	last_write = cyc;
 }
 
+void Mapper1::serialize( SaveState &save )
+{
+	Mapper::serialize( save );
+	save.io( shifter );
+	save.io( bankmode_prg );
+	save.io( bankmode_chr );
+	save.io( bank_chr_2 );
+	save.io( bank_prg_256k );
+	save.io( last_write );
+}
+
 // === MAPPER 4 (MMC3) ===
 
 u8 *Mapper4::map_cpu( u16 address )
@@ -316,6 +372,8 @@ void Mapper4::handle_write( u8 data, u16 addr )
 				}
 			}
 		}
+		update_cpu_pages();
+		update_ppu_pages();
 	}
 	else if ( addr < 0xC000 )		// $A000-$BFFF: mirroring/ram protect
 	{
@@ -374,6 +432,32 @@ void Mapper4::handle_ppu_rising_edge()
 	}
 }
 
+long Mapper4::ppu_dots_until_irq()
+{
+	if ( irq_pending || irq_disable )
+	{
+		return -1;
+	}
+
+	long edges = (irq_counter == 0 || irq_reload) ? irq_reload_val + 1 : irq_counter;
+	// The PPU's A12 filter needs 4 M2 cycles (12 dots) between counted rising edges
+	return (edges - 1) * 12;
+}
+
+void Mapper4::serialize( SaveState &save )
+{
+	Mapper::serialize( save );
+	save.io( bankmode_prg );
+	save.io( bankmode_chr );
+	save.io( bank_prg_2 );
+	save.io( bank_chr_2kb );
+	save.io( bank_chr_1kb );
+	save.io( bank_select );
+	save.io( irq_counter );
+	save.io( irq_reload_val );
+	save.io( irq_reload );
+}
+
 // === MAPPER 7 (AxROM) ===
 
 u8 *Mapper7::map_cpu( u16 address )
@@ -395,6 +479,7 @@ void Mapper7::handle_write( u8 data, u16 addr )
 
 	bank_prg = data & 0x7;
 	set_mirroring( ((data >> 4) & 0x1) ? OneScreen_HB : OneScreen_LB );
+	update_cpu_pages();
 }
 
 // === MAPPER 11 (Color Dreams) ===
@@ -428,6 +513,8 @@ void Mapper11::handle_write( u8 data, u16 addr )
 
 	bank_prg = data & 0x3;
 	bank_chr = data >> 4;
+	update_cpu_pages();
+	update_ppu_pages();
 }
 
 // === MAPPER 69 (FME-7) ===
@@ -482,6 +569,7 @@ void Mapper69::handle_write( u8 data, u16 addr )
 		if ( command <= 0x7 )			// $0-$7: CHR bank select
 		{
 			chr_banks[ command ] = data % (chr_size / 0x400);
+			update_ppu_pages();
 		}
 		else if ( command <= 0xB )		// $8-$B: PRG bank select
 		{
@@ -491,6 +579,7 @@ void Mapper69::handle_write( u8 data, u16 addr )
 			{
 				prg_bank0_ram = (data >> 6) & 0x1;
 			}
+			update_cpu_pages();
 		}
 		else if ( command == 0xC )		// $C: mirroring select
 		{
@@ -540,17 +629,32 @@ void Mapper69::handle_write( u8 data, u16 addr )
 	}
 }
 
-void Mapper69::handle_cpu_cycle()
+void Mapper69::handle_cpu_cycles( int cycles )
 {
 	if ( irq_counter_enable )
 	{
-		if ( --irq_counter == 0xFFFF && !irq_disable )
+		// The IRQ fires as the counter wraps from $0000 to $FFFF
+		if ( irq_counter < cycles && !irq_disable )
 		{
 			irq_pending = true;
 		}
+		irq_counter -= cycles;
 	}
 }
 
+void Mapper69::serialize( SaveState &save )
+{
+	Mapper::serialize( save );
+	save.io( irq_counter );
+	save.io( irq_counter_enable );
+	save.io( prg_banks );
+	save.io( chr_banks );
+	save.io( prg_bank0_ram );
+	save.io( command );
+	save.io( sound_chip_reg );
+	save.io( sound_chip_write_enable );
+}
+
 // === MAPPER 184 (Sunsoft-1) ===
 
 u8 *Mapper184::map_ppu( u16 address )
@@ -574,6 +678,20 @@ void Mapper184::handle_write( u8 data, u16 addr )
 
 	bank_chr = GET_BITS( data, 0, 3 ) % (chr_size / 0x1000);
 	bank_chr_2 = (GET_BITS( data, 4, 3 ) | 0x4) % (chr_size / 0x1000);
+	update_ppu_pages();
+}
+
+void Mapper184::update_cpu_pages()
+{
+	Mapper::update_cpu_pages();
+	// The bank register sits on top of PRG-RAM, so those stores must reach handle_write()
+	std::fill( cpu_write_pages + (0x6000 >> CPU_PAGE_SHIFT), cpu_write_pages + (0x8000 >> CPU_PAGE_SHIFT), nullptr );
+}
+
+void Mapper184::serialize( SaveState &save )
+{
+	Mapper::serialize( save );
+	save.io( bank_chr_2 );
 }
 
 // === MAPPER 228 (Active Enterprises) ===
@@ -627,4 +745,23 @@ void Mapper228::handle_write( u8 data, u16 addr )
 	prg_bankmode = (addr >> 5) & 0x1;
 	prg_chip = (addr >> 11) & 0x3;
 	set_mirroring( (addr >> 13) & 0x1 ? Horizontal : Vertical );
+	update_cpu_pages();
+	update_ppu_pages();
+}
+
+void Mapper228::update_cpu_pages()
+{
+	Mapper::update_cpu_pages();
+	if ( prg_chip == 2 )
+	{
+		// Open bus: every address reads the same byte, which a page can't express
+		std::fill( cpu_read_pages + (0x8000 >> CPU_PAGE_SHIFT), cpu_read_pages + CPU_PAGES, nullptr );
+	}
+}
+
+void Mapper228::serialize( SaveState &save )
+{
+	Mapper::serialize( save );
+	save.io( prg_bankmode );
+	save.io( prg_chip );
 }
\ No newline at end of file
@@ -18,33 +18,137 @@ enum class SCType
 
 class SoundChip;
 
+class SaveState;
+
 // === MAPPER 0 (NROM) ===
 
 class Mapper
 {
 public:
+	// The CPU address space is split into 2KB pages, the size of the RAM mirrors
+	static constexpr int CPU_PAGE_SHIFT = 11;
+	static constexpr int CPU_PAGE_MASK = (1 << CPU_PAGE_SHIFT) - 1;
+	static constexpr int CPU_PAGES = 0x10000 >> CPU_PAGE_SHIFT;
+
+	// The PPU address space is split into 1KB pages, the size of a nametable and the smallest CHR bank
+	static constexpr int PPU_PAGE_SHIFT = 10;
+	static constexpr int PPU_PAGE_MASK = (1 << PPU_PAGE_SHIFT) - 1;
+	static constexpr int PPU_PAGES = 0x4000 >> PPU_PAGE_SHIFT;
+
 	explicit Mapper( Cartridge *cart );
 
 	~Mapper() = default;
 
 	virtual u8 *map_cpu( u16 addr );
 
+	// Memory behind a CPU page, or nullptr where the access has to go through the registers, the mapper or
+	// open bus instead
+	u8 *cpu_read_page( u16 addr ) const
+	{
+		return cpu_read_pages[ addr >> CPU_PAGE_SHIFT ];
+	}
+
+	// As above, but only for RAM that nothing else listens to
+	u8 *cpu_write_page( u16 addr ) const
+	{
+		return cpu_write_pages[ addr >> CPU_PAGE_SHIFT ];
+	}
+
+	// Rebuilds the page table from map_cpu(); must be called whenever the PRG banking changes
+	virtual void update_cpu_pages();
+
 	virtual u8 *map_ppu( u16 addr );
 
+	// Memory behind a PPU page below $3F00; $3C00-$3EFF mirrors the nametables like the rest of $3000-$3FFF
+	u8 *ppu_page( u16 addr ) const
+	{
+		return ppu_pages[ (addr >> PPU_PAGE_SHIFT) & (PPU_PAGES - 1) ];
+	}
+
+	// Decoded pattern row at addr, below $2000, from the tile cache pages kept alongside the page table
+	u16 tile_row( u16 addr ) const
+	{
+		return tile_pages[ addr >> PPU_PAGE_SHIFT ][ TileCache::row_index( addr & PPU_PAGE_MASK ) ];
+	}
+
+	TileCache *get_tile_cache() const
+	{
+		return tiles;
+	}
+
+	// Rebuilds the page table from map_ppu(); must be called whenever the CHR banking or mirroring changes
+	void update_ppu_pages();
+
 	virtual void handle_write( u8 data, u16 addr )
 	{}
 
-	virtual void handle_ppu_rising_edge()
-	{}
+	// Hooks on the CPU and PPU hot paths are bound once per mapper type by create(); a mapper that doesn't
+	// declare one leaves it null and the caller skips it entirely
+	typedef void (*CpuCycleHook)( Mapper *mapper, int cycles );
+	typedef void (*RisingEdgeHook)( Mapper *mapper );
 
-	virtual void handle_cpu_cycle()
-	{}
+	static constexpr bool CLOCKS_CPU = false;
+	static constexpr bool WATCHES_A12 = false;
+
+	template < typename M >
+	static M *create( Cartridge *cart )
+	{
+		M *mapper = new M( cart );
+		if constexpr ( M::CLOCKS_CPU )
+		{
+			mapper->cpu_cycle_hook = []( Mapper *m, int cycles )
+			{
+				static_cast< M * >( m )->handle_cpu_cycles( cycles );
+			};
+		}
+		if constexpr ( M::WATCHES_A12 )
+		{
+			mapper->rising_edge_hook = []( Mapper *m )
+			{
+				static_cast< M * >( m )->handle_ppu_rising_edge();
+			};
+		}
+		return mapper;
+	}
+
+	void clock_cpu( int cycles )
+	{
+		if ( cpu_cycle_hook != nullptr )
+		{
+			cpu_cycle_hook( this, cycles );
+		}
+	}
+
+	bool clocks_cpu() const
+	{
+		return cpu_cycle_hook != nullptr;
+	}
+
+	bool watches_a12() const
+	{
+		return rising_edge_hook != nullptr;
+	}
+
+	void ppu_rising_edge()
+	{
+		rising_edge_hook( this );
+	}
+
+	// Lower bound on PPU dots before A12 edges can raise an IRQ, or -1 if they can't
+	virtual long ppu_dots_until_irq()
+	{
+		return -1;
+	}
+
+	// Banking and IRQ registers; the memory they point into is saved with the cartridge
+	virtual void serialize( SaveState &save );
 
 	void set_mirroring( MIRRORING mirr )
 	{
-		if ( !force_mirroring )
+		if ( !force_mirroring && mirroring != mirr )
 		{
 			mirroring = mirr;
+			update_ppu_pages();
 		}
 	}
 	
@@ -63,6 +167,27 @@ public:
 		return prg_ram != nullptr;
 	}
 
+	u32 get_prg_size() const
+	{
+		return prg_size;
+	}
+
+	// Offset into PRG ROM of memory handed out by the page table, or -1 if it isn't PRG ROM
+	long prg_rom_offset( const u8 *mem ) const
+	{
+		return mem >= prg_rom && mem < prg_rom + prg_size ? mem - prg_rom : -1;
+	}
+
+	long chr_rom_offset( const u8 *mem ) const
+	{
+		return chr_rom != nullptr && mem >= chr_rom && mem < chr_rom + chr_size ? mem - chr_rom : -1;
+	}
+
+	bool has_chr_ram()
+	{
+		return chr_rom == nullptr;
+	}
+
 	bool check_irq()
 	{
 		return irq_pending && !irq_disable;
@@ -103,7 +228,17 @@ protected:
 	bool irq_pending = false;
 	bool irq_disable = false;
 
+	u8 *cpu_read_pages[ CPU_PAGES ] = { nullptr };
+	u8 *cpu_write_pages[ CPU_PAGES ] = { nullptr };
+	u8 *ppu_pages[ PPU_PAGES ] = { nullptr };
+	TileCache *tiles;
+	const u16 *tile_pages[ 0x2000 >> PPU_PAGE_SHIFT ] = { nullptr };
+
 	SoundChip *sound_chip = nullptr;
+
+private:
+	CpuCycleHook cpu_cycle_hook = nullptr;
+	RisingEdgeHook rising_edge_hook = nullptr;
 };
 
 // === MAPPER 1 (MMC1) ===
@@ -121,6 +256,8 @@ public:
 
 	void handle_write( u8 data, u16 addr ) override;
 
+	void serialize( SaveState &save ) override;
+
 private:
 	u8 shifter = 0x80;
 
@@ -166,6 +303,7 @@ public:
 			return;
 		}
 		bank_prg = data & ((prg_size / 0x4000) - 1);
+		update_cpu_pages();
 	}
 };
 
@@ -195,6 +333,7 @@ public:
 			return;
 		}
 		bank_chr = data & 0x3;//((chr_size / 0x2000) - 1);
+		update_ppu_pages();
 	}
 };
 
@@ -210,9 +349,15 @@ public:
 
 	u8 *map_ppu( u16 address ) override;
 
+	static constexpr bool WATCHES_A12 = true;
+
 	void handle_write( u8 data, u16 addr ) override;
 
-	void handle_ppu_rising_edge() override;
+	void handle_ppu_rising_edge();
+
+	long ppu_dots_until_irq() override;
+
+	void serialize( SaveState &save ) override;
 
 private:
 	bool bankmode_prg = 0;
@@ -269,9 +414,13 @@ public:
 
 	u8 *map_ppu( u16 address ) override;
 
+	static constexpr bool CLOCKS_CPU = true;
+
 	void handle_write( u8 data, u16 addr ) override;
 
-	void handle_cpu_cycle() override;
+	void handle_cpu_cycles( int cycles );
+
+	void serialize( SaveState &save ) override;
 
 	const SCType get_sound_chip_type() override
 	{
@@ -304,6 +453,10 @@ public:
 
 	void handle_write( u8 data, u16 addr ) override;
 
+	void update_cpu_pages() override;
+
+	void serialize( SaveState &save ) override;
+
 private:
 	u8 bank_chr_2 = 1;
 };
@@ -322,6 +475,10 @@ public:
 
 	void handle_write( u8 data, u16 addr ) override;
 
+	void update_cpu_pages() override;
+
+	void serialize( SaveState &save ) override;
+
 private:
 	bool prg_bankmode = 0;
 	u8 prg_chip = 0;
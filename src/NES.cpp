@@ -2,64 +2,134 @@
 #include "CPU.h"
 #include "PPU.h"
 #include "Cartridge.h"
-#include "Display.h"
 #include "IO.h"
-#include "UI.h"
 #include "APU/APU.h"
+#include "Mapper.h"
+#include "SaveState.h"
+#include <iostream>
+#ifndef NESPRIME_HEADLESS
+#include "Display.h"
+#include "UI.h"
 #include <SDL.h>
 #include <SDL_ttf.h>
-#include <iostream>
+#endif
 
 #define CPF (CPS / FPS * EMU_SPEED)
 
 NES::NES()
 {
+#ifndef NESPRIME_HEADLESS
 	if ( SDL_Init( SDL_INIT_VIDEO | SDL_INIT_AUDIO ) != 0 || TTF_Init() != 0 )
 	{
 		SDL_Log( "Unable to initialize SDL: %s", SDL_GetError() );
 		exit( EXIT_FAILURE );
 	}
+#endif
 
 	EMU_SPEED = 1.0;
 
 	set_cpu( new CPU() );
 	set_ppu( new PPU() );
 	set_cart( new Cartridge() );
+#ifndef NESPRIME_HEADLESS
 	set_display( new Display() );
+#else
+	display = nullptr;
+	ui = nullptr;
+#endif
 	set_io( new IO() );
 	set_apu( new APU() );
+#ifndef NESPRIME_HEADLESS
 	set_ui( new UI() );
+#endif
 
 	out.open( "out.txt" );
 }
 
 NES::~NES()
 {
+#ifndef NESPRIME_HEADLESS
 	display->close();
+#endif
+}
+
+#ifdef NESPRIME_HEADLESS
+void NES::run()
+{
+	// No window or audio device to pace against, so run as fast as the host allows
+	while ( !quit )
+	{
+		step();
+	}
+
+	dump_saves();
+}
+
+void NES::run_frames( long frames )
+{
+	long end_frame = ppu->get_frame() + frames;
+	while ( !quit && ppu->get_frame() < end_frame )
+	{
+		// Step until the CPU may have passed the end of the frame. The estimate only holds while nothing
+		// has been caught up, as a DMC stall runs an extra dot
+		u64 synced = clock;
+		u64 frame_end = ((clock + 3) & ~(u64)3) + 4 * (u64)ppu->dots_until( 239, 340 );
+		while ( !quit && target <= frame_end && target <= horizon && clock == synced )
+		{
+			step( frame_end );
+		}
+		catch_up();
+	}
+
+	dump_saves();
 }
 
+void NES::run_instructions( long instructions )
+{
+	long end = cpu->get_instructions() + instructions;
+	while ( !quit && cpu->get_instructions() < end )
+	{
+		step( UINT64_MAX, end );
+	}
+	catch_up();
+
+	dump_saves();
+}
+#else
 void NES::run()
 {
 	ui->init();
 
 	while ( !quit )
 	{
-		if ( !ui->get_show() )
+		// The loop spins until check_refresh() lets the next frame start, so only snapshot when one does
+		if ( !ui->get_show() && cycles_delta < CPF )
 		{
+			// While backspace is held, each frame replays the one before the last instead of recording a new one
+			if ( !(SDL_GetKeyboardState( nullptr )[ SDL_SCANCODE_BACKSPACE ] && rewind.step_back( this )) )
+			{
+				rewind.push( this );
+			}
 			while ( cycles_delta < CPF )
 			{
-				tick( true, 1 );
+				step();
 			}
+			catch_up();
 		}
 		check_refresh();
 	}
 
-	cart->dump_sram();
+	dump_saves();
+#ifdef NESPRIME_PROFILER
+	cpu->get_profiler()->write_flat( "NESP_Saves/" + filename + ".profile.txt" );
+	cpu->get_profiler()->write_collapsed( "NESP_Saves/" + filename + ".folded" );
+#endif
 }
+#endif
 
 void NES::reset()
 {
-	cart->dump_sram();
+	dump_saves();
 
 	delete cart;
 	delete cpu;
@@ -70,11 +140,129 @@ void NES::reset()
 	set_cpu( new CPU() );
 	set_ppu( new PPU() );
 	set_apu( new APU() );
+	rewind.clear();
 
 	clock = 0;
+	target = 0;
+	horizon = 0;
+	irq_horizon = 0;
+}
+
+void NES::save_state( std::vector< u8 > &out )
+{
+	catch_up();
+	SaveState save = SaveState::writer( out );
+	serialize_header( save );
+	serialize( save );
+}
+
+bool NES::load_state( const u8 *data, size_t size )
+{
+	SaveState header = SaveState::reader( data, size );
+	if ( !serialize_header( header ) )
+	{
+		return false;
+	}
+
+	// A state can still turn out truncated halfway through, so keep one to fall back on
+	save_state( state_backup );
+	SaveState save = SaveState::reader( data, size );
+	serialize_header( save );
+	serialize( save );
+	bool loaded = save.ok() && save.at_end();
+	if ( !loaded )
+	{
+		SaveState restore = SaveState::reader( state_backup.data(), state_backup.size() );
+		serialize_header( restore );
+		serialize( restore );
+	}
+
+	update_horizon();
+	return loaded;
+}
+
+void NES::set_cdl_logging( bool enabled )
+{
+	if ( enabled && !cdl_logging )
+	{
+		cart->load_cdl();
+	}
+	else if ( !enabled && cdl_logging )
+	{
+		cart->dump_cdl();
+	}
+	cdl_logging = enabled;
+	cpu->set_cdl( enabled ? cart->get_cdl() : nullptr );
+	ppu->set_cdl( enabled ? cart->get_cdl() : nullptr );
+}
+
+void NES::dump_saves()
+{
+	cart->dump_sram();
+	if ( cdl_logging )
+	{
+		cart->dump_cdl();
+	}
+}
+
+void NES::set_tracing( bool enabled )
+{
+	trace.set_enabled( enabled );
+	cpu->set_trace( enabled ? &trace : nullptr );
 }
 
-bool NES::run( const nfdchar_t *fn )
+bool NES::save_state_file( const std::string &path )
+{
+	std::vector< u8 > state;
+	save_state( state );
+	std::ofstream file( path, std::ios::binary );
+	file.write( (const char *)state.data(), state.size() );
+	return file.good();
+}
+
+bool NES::load_state_file( const std::string &path )
+{
+	std::ifstream file( path, std::ios::binary );
+	if ( !file.good() )
+	{
+		return false;
+	}
+	std::vector< u8 > state( (std::istreambuf_iterator< char >( file )), std::istreambuf_iterator< char >() );
+	return load_state( state.data(), state.size() );
+}
+
+// Identifies the format and the ROM a state belongs to; on load, false if they don't match
+bool NES::serialize_header( SaveState &save )
+{
+	u32 magic = SaveState::MAGIC;
+	u32 version = SaveState::VERSION;
+	u16 mapper_num = cart->get_mapper_num();
+	u32 prg_size = cart->get_prg_size();
+	u32 chr_size = cart->get_chr_size();
+	save.io( magic );
+	save.io( version );
+	save.io( mapper_num );
+	save.io( prg_size );
+	save.io( chr_size );
+
+	return save.ok() && magic == SaveState::MAGIC && version == SaveState::VERSION
+	       && mapper_num == cart->get_mapper_num() && prg_size == cart->get_prg_size()
+	       && chr_size == cart->get_chr_size();
+}
+
+void NES::serialize( SaveState &save )
+{
+	save.io( clock );
+	save.io( target );
+	cpu->serialize( save );
+	ppu->serialize( save );
+	cart->serialize( save );
+	io->serialize( save );
+	// Last, as its sample buffers vary in length and would shift everything after them between frames
+	apu->serialize( save );
+}
+
+bool NES::run( const char *fn )
 {
 	reset();
 	std::string filename_copy = filename;
@@ -83,18 +271,31 @@ bool NES::run( const nfdchar_t *fn )
 	filename = filename.substr( 0, filename.find_last_of( '.' ) );
 	if ( cart->open_file( fn ) && cart->load() )
 	{
+		// The CPU is new, so carry over whether it traces, and pick up the new ROM's code/data log
+		set_tracing( trace.is_enabled() );
+		if ( cdl_logging )
+		{
+			cdl_logging = false;
+			set_cdl_logging( true );
+		}
 		cpu->init();
+		catch_up();
+		// The first instruction starts on the next CPU cycle boundary
+		target += (12 - target % 12) % 12;
 		apu->init();
+#ifndef NESPRIME_HEADLESS
 		display->reset();
 		ui->set_state( UIState::PAUSE );
 		ui->set_show( false );
 		SDL_Delay( 250 );
+#endif
 		return true;
 	}
 	filename = filename_copy;
 	return false;
 }
 
+#ifndef NESPRIME_HEADLESS
 void NES::check_refresh()
 {
 	Uint32 t = SDL_GetTicks();
@@ -179,19 +380,115 @@ void NES::check_refresh()
 		display->last_update = t;
 	}
 }
+#endif
 
-void NES::tick( bool do_cpu, int times )
+void NES::step( u64 clock_limit, long instruction_limit )
 {
-	for ( int i = 0; i < times; i++ )
+	u64 start = target;
+	cpu->run();
+	sync_if_due( true );
+
+	// The CPU only starts a cycle on a 12 clock boundary; the clocks left over belong to the PPU and APU
+	if ( target % 12 == 0 )
 	{
-		if ( cpu->memory_regs[0x16] & 0x1 )
+		// This stretch holds an APU cycle that may stall the CPU for a DMC fetch, so walk it clock by clock
+		catch_up();
+		catching_up = true;
+		do
 		{
-			io->poll();
+			tick( 1 );
 		}
-		if ( clock % 12 == 0 && do_cpu )
+		while ( clock % 12 != 0 );
+		catching_up = false;
+		target = clock;
+		update_horizon();
+	}
+	else
+	{
+		target += 12 - target % 12;
+	}
+
+#ifndef NESPRIME_PROFILER
+	// The profiler has to see every iteration of an idle loop to charge its cycles
+	if ( cpu->get_idle_period() > 0 && !trace.is_enabled() )
+	{
+		skip_idle_loop( clock_limit, instruction_limit );
+	}
+#endif
+
+	cycles_delta += target - start;
+}
+
+void NES::skip_idle_loop( u64 clock_limit, long instruction_limit )
+{
+	// Until the PPU or APU can reach the CPU, each iteration does exactly what the last one did, so the CPU
+	// can jump over them without running a single one
+	u64 limit = std::min( { horizon, irq_horizon, clock_limit } );
+	u64 period = 12 * (u64)cpu->get_idle_period();
+	if ( target >= limit )
+	{
+		return;
+	}
+	long iterations = (limit - target) / period;
+	iterations = std::min( iterations, (instruction_limit - cpu->get_instructions()) / cpu->get_idle_instructions() );
+	if ( iterations > 0 )
+	{
+		target += iterations * period;
+		cpu->skip_idle_iterations( iterations );
+	}
+}
+
+void NES::catch_up()
+{
+	catching_up = true;
+	// Only clocks with a PPU dot do any work, so jump from dot to dot
+	for ( u64 dot = (clock + 3) & ~(u64)3; dot < target; dot = (clock + 3) & ~(u64)3 )
+	{
+		clock = dot;
+		ppu->run();
+		if ( clock % 12 == 0 )
 		{
-			cpu->run();
+			apu->cycle();
 		}
+		++clock;
+	}
+	clock = target;
+	catching_up = false;
+	// The CPU may touch the PPU next, so draw what has been rendered with the state it was rendered under
+	ppu->flush_line();
+
+	update_horizon();
+}
+
+void NES::update_horizon()
+{
+	u64 next_dot = (clock + 3) & ~(u64)3;
+	u64 next_apu = (clock + 11) / 12 * 12;
+
+	horizon = next_dot + 4 * (u64)ppu->dots_until( 241, 4 );
+	long dmc = apu->cycles_until_dmc_fetch();
+	if ( dmc >= 0 )
+	{
+		horizon = std::min( horizon, next_apu + 12 * dmc );
+	}
+
+	irq_horizon = UINT64_MAX;
+	long apu_irq = apu->cycles_until_irq();
+	if ( apu_irq >= 0 )
+	{
+		irq_horizon = next_apu + 12 * apu_irq;
+	}
+	long mapper_irq = cpu->get_mapper()->ppu_dots_until_irq();
+	if ( mapper_irq >= 0 )
+	{
+		irq_horizon = std::min( irq_horizon, next_dot + 4 * mapper_irq );
+	}
+}
+
+void NES::tick( int times )
+{
+	for ( int i = 0; i < times; i++ )
+	{
 		if ( clock % 4 == 0 )
 		{
 			ppu->run();
@@ -202,7 +499,6 @@ void NES::tick( bool do_cpu, int times )
 		}
 
 		++clock;
-		++cycles_delta;
 	}
 }
 
@@ -224,11 +520,13 @@ void NES::set_cart( Cartridge *cart )
 	cart->set_nes( this );
 }
 
+#ifndef NESPRIME_HEADLESS
 void NES::set_display( Display *display )
 {
 	this->display = display;
 	display->set_nes( this );
 }
+#endif
 
 void NES::set_io( IO *io )
 {
@@ -242,8 +540,10 @@ void NES::set_apu( APU *apu )
 	apu->set_nes( this );
 }
 
+#ifndef NESPRIME_HEADLESS
 void NES::set_ui( UI *ui )
 {
 	this->ui = ui;
 	ui->set_nes( this );
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <algorithm>
+#include <climits>
 #include <string>
 #include <fstream>
-#include <nfd.h>
+#include <vector>
+#include "FrameBuffer.h"
+#include "Rewind.h"
+#include "Trace.h"
 
 class CPU;
 
@@ -19,6 +23,8 @@ class APU;
 
 class UI;
 
+class SaveState;
+
 class NES
 {
 public:
@@ -28,19 +34,71 @@ public:
 
 	void run();
 
-	bool run( const nfdchar_t *fn );
+	bool run( const char *fn );
+
+#ifdef NESPRIME_HEADLESS
+	void run_frames( long frames );
 
+	void run_instructions( long instructions );
+#else
 	void check_refresh();
+#endif
+
+	// Called by the CPU for every master clock it spends; the PPU and APU lag behind until catch_up()
+	void advance( int clocks )
+	{
+		target += clocks;
+		if ( catching_up )
+		{
+			// Cycles stolen from inside the APU (DMC fetches) stall on the spot
+			tick( clocks );
+		}
+	}
+
+	void catch_up();
+
+	// Catch up only if the PPU/APU may have raised something the CPU is about to look at
+	void sync_if_due( bool irq_masked )
+	{
+		if ( target > horizon || (!irq_masked && target > irq_horizon) )
+		{
+			catch_up();
+		}
+	}
 
-	void tick( bool do_cpu, int times );
+	void update_horizon();
 
 	void reset();
 
+	// Snapshots the running machine into out, reusing its capacity. The frame buffer is left out; the next
+	// frame redraws it
+	void save_state( std::vector< u8 > &out );
+
+	// Restores a snapshot of the same ROM taken with save_state(). Nothing changes if the state is rejected
+	bool load_state( const u8 *data, size_t size );
+
+	bool save_state_file( const std::string &path );
+
+	bool load_state_file( const std::string &path );
+
 	void kill()
 	{
 		quit = true;
 	}
 
+	// Records every instruction and CPU bus access into the trace ring. Idle loop skipping is left
+	// out while it runs, so that no instruction goes unrecorded
+	void set_tracing( bool enabled );
+
+	// Logs which PRG and CHR ROM bytes are used as code, data, DMC samples or tiles, adding to the ROM's .cdl
+	// file, which is written out wherever battery RAM is
+	void set_cdl_logging( bool enabled );
+
+	bool is_cdl_logging()
+	{
+		return cdl_logging;
+	}
+
 	void set_emu_speed(float val) 
 	{
 		EMU_SPEED = std::clamp( (double)val, 0.0, 3.0 );
@@ -91,19 +149,38 @@ public:
 		return ui;
 	}
 
+	FrameBuffer *get_frame_buffer()
+	{
+		return &frame_buffer;
+	}
+
+	Rewind *get_rewind()
+	{
+		return &rewind;
+	}
+
+	Trace *get_trace()
+	{
+		return &trace;
+	}
+
 	void set_cpu( CPU *cpu );
 
 	void set_ppu( PPU *ppu );
 
 	void set_cart( Cartridge *cart );
 
+#ifndef NESPRIME_HEADLESS
 	void set_display( Display *display );
+#endif
 
 	void set_io( IO *io );
 
 	void set_apu( APU *apu );
 
+#ifndef NESPRIME_HEADLESS
 	void set_ui( UI *ui );
+#endif
 
 	bool DEBUG_PATTERNTABLE = false;
 	bool DEBUG_NAMETABLE = false;
@@ -112,6 +189,9 @@ public:
 	std::ofstream out;
 	std::string filename;
 private:
+	// Battery RAM, and the code/data log if it is on
+	void dump_saves();
+
 	Cartridge *cart;
 	CPU *cpu;
 	PPU *ppu;
@@ -119,6 +199,10 @@ private:
 	IO *io;
 	APU *apu;
 	UI *ui;
+	FrameBuffer frame_buffer;
+	Rewind rewind;
+	Trace trace;
+	bool cdl_logging = false;
 
 	static constexpr int CPS = 21477272;
 	static constexpr int FPS = 60;
@@ -126,8 +210,28 @@ private:
 
 	float cycles_delta = 0;
 
-	long clock = 0;
+	// Master clocks the PPU/APU have run up to, and how far the CPU has gone ahead of them
+	u64 clock = 0;
+	u64 target = 0;
+	// Earliest clocks at which the lagging components could raise an NMI, stall the CPU or raise an IRQ
+	u64 horizon = 0;
+	u64 irq_horizon = 0;
+	bool catching_up = false;
+
 	bool quit = false;
 
+	// Runs one instruction. An idle loop is fast-forwarded no further than clock_limit or instruction_limit
+	void step( u64 clock_limit = UINT64_MAX, long instruction_limit = LONG_MAX );
+
+	void skip_idle_loop( u64 clock_limit, long instruction_limit );
+
+	void tick( int times );
+
 	void dump_ram();
+
+	bool serialize_header( SaveState &save );
+
+	void serialize( SaveState &save );
+
+	std::vector< u8 > state_backup;
 };
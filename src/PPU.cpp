@@ -1,14 +1,24 @@
 #include "PPU.h"
 #include "CPU.h"
-#include "Display.h"
 #include "util.h"
 #include "data.h"
+#include "SaveState.h"
+#include <array>
+#include <bit>
 #include <cmath>
+#include <cstring>
+#if defined( __SSE2__ ) || defined( _M_X64 ) || (defined( _M_IX86_FP ) && _M_IX86_FP >= 2)
+#define PPU_SSE2
+#include <emmintrin.h>
+#endif
+#ifndef NESPRIME_HEADLESS
+#include "Display.h"
+#endif
 
 PPU::PPU() : Processor()
 {
 	this->PPU::reset();
-	this->regs[PPUSTATUS] = 0x0;
+	std::fill( palette, palette + 32, 0x1D );
 	this->set_default_palette();
 }
 
@@ -20,12 +30,106 @@ void PPU::init()
 {
 }
 
+inline u8 *PPU::vram( u16 addr )
+{
+	return &mapper->ppu_page( addr )[ addr & Mapper::PPU_PAGE_MASK ];
+}
+
+inline u8 PPU::fetch( u16 addr )
+{
+	u8 *mem = vram( addr );
+	if ( cdl != nullptr )
+	{
+		cdl->mark_chr( mapper->chr_rom_offset( mem ), CodeDataLog::RENDERED );
+	}
+	return *mem;
+}
+
+inline u16 PPU::fetch_row( u16 addr )
+{
+	if ( cdl != nullptr )
+	{
+		cdl->mark_chr( mapper->chr_rom_offset( vram( addr ) ), CodeDataLog::RENDERED );
+		cdl->mark_chr( mapper->chr_rom_offset( vram( addr + 8 ) ), CodeDataLog::RENDERED );
+	}
+	return mapper->tile_row( addr );
+}
+
+// Which of run()'s actions happen on each dot of each kind of line, so that a dot costs one table lookup rather
+// than a range test per action
+enum LineType : u8
+{
+	PRE_RENDER, VISIBLE, POST_RENDER, VBLANK_START, VBLANK, LINE_TYPES
+};
+
+static constexpr std::array< LineType, 262 > build_line_types()
+{
+	std::array< LineType, 262 > types{};
+	for ( int line = -1; line <= 260; line++ )
+	{
+		types[line + 1] = line == -1 ? PRE_RENDER : line < 240 ? VISIBLE : line == 240 ? POST_RENDER
+		                                          : line == 241 ? VBLANK_START : VBLANK;
+	}
+	return types;
+}
+
+static constexpr std::array< std::array< u16, 341 >, LINE_TYPES > build_dot_actions()
+{
+	std::array< std::array< u16, 341 >, LINE_TYPES > table{};
+	for ( int type = 0; type < LINE_TYPES; type++ )
+	{
+		bool fetches = type == PRE_RENDER || type == VISIBLE;
+		for ( int dot = 0; dot <= 340; dot++ )
+		{
+			u16 actions = 0;
+			if ( type == VBLANK_START && dot == 4 )
+			{
+				actions |= PPU::SET_VBLANK;
+			}
+			if ( type == PRE_RENDER && dot == 1 )
+			{
+				actions |= PPU::CLEAR_FLAGS;
+			}
+			if ( type <= POST_RENDER && dot >= 2 && dot <= 257 )
+			{
+				actions |= PPU::SHIFT;
+			}
+			if ( type == VISIBLE )
+			{
+				actions |= dot >= 1 && dot <= 256 ? PPU::DRAW : 0;
+				actions |= dot == 256 ? PPU::FLUSH : 0;
+				actions |= dot >= 1 && dot <= 64 && dot % 2 == 0 ? PPU::CLEAR_OAM2 : 0;
+				actions |= dot == 257 ? PPU::EVAL_SPRITES : 0;
+			}
+			if ( fetches )
+			{
+				actions |= dot >= 257 && dot <= 320 && (dot - 257) % 8 >= 4 ? PPU::SPRITE_FETCH : 0;
+				// Every 8 dots, increment coarse X and update shift registers
+				actions |= (dot - 2) % 8 == 7 && (dot >= 329 || dot <= 257) ? PPU::FETCH : 0;
+				actions |= (dot - 2) % 8 == 7 && dot >= 329 ? PPU::PREFETCH_SHIFT : 0;
+				actions |= dot == 256 ? PPU::INC_Y : 0;
+				actions |= dot == 257 ? PPU::COPY_HORIZ : 0;
+			}
+			if ( type == PRE_RENDER && dot >= 280 && dot <= 304 )
+			{
+				actions |= PPU::COPY_VERT;
+			}
+			table[type][dot] = actions;
+		}
+	}
+	return table;
+}
+
+static constexpr std::array< LineType, 262 > LINE_TYPE = build_line_types();
+static constexpr std::array< std::array< u16, 341 >, LINE_TYPES > DOT_ACTIONS = build_dot_actions();
+
 bool PPU::run()
 {
+	++dots;
 	a12_set = false;
-	bool tall_sprites = (regs[PPUCTRL] >> 5) & 0x1;
+	u16 actions = DOT_ACTIONS[LINE_TYPE[scanline + 1]][scan_cycle];
 
-	if ( scanline == 241 && scan_cycle == 4 )
+	if ( actions & SET_VBLANK )
 	{
 		// Set the v-blank flag on dot 1 of line 241
 		regs[PPUSTATUS] |= 0x80;
@@ -35,377 +139,469 @@ bool PPU::run()
 			nes->get_cpu()->trigger_nmi();
 		}
 	}
-	else if ( scanline == -1 && scan_cycle == 1 )
+	else if ( actions & CLEAR_FLAGS )
 	{
 		// Clear the v-blank flag and sprite overflow flag on dot 1 of pre-render line
 		regs[PPUSTATUS] &= ~0xE0;
 		nmi_occurred = false;
 	}
 
-	bool render_bgr_l = (regs[PPUMASK] >> 1) & 0x1;
-	bool render_spr_l = (regs[PPUMASK] >> 2) & 0x1;
-	bool render_bgr = (regs[PPUMASK] >> 3) & 0x1;
-	bool render_spr = (regs[PPUMASK] >> 4) & 0x1;
-	bool emphasis_r = (regs[PPUMASK] >> 5) & 0x1;
-	bool emphasis_g = (regs[PPUMASK] >> 6) & 0x1;
-	bool emphasis_b = (regs[PPUMASK] >> 7) & 0x1;
-
-	bool do_render = render_bgr || render_spr;
+	bool do_render = (regs[PPUMASK] & 0x18) != 0;
 
-	if ( do_render )
+	if ( do_render && (actions & RENDER_ACTIONS) )
 	{
-		if ( scanline <= 240 )
+		if ( actions & SHIFT )
 		{
-			u8 *bgr_rgb = nullptr;
-			u8 *spr_rgb = nullptr;
-			bool spr_priority = false;
-			bool bgr_base = true;
-
-			if ( (scan_cycle >= 2 && scan_cycle <= 257) )
+			tile_shift <<= 2;
+			for ( int i = 0; i < 2; i++ )
 			{
-				for ( int i = 0; i < 2; i++ )
-				{
-					tile_shift_regs[i] <<= 1;
-					tile_attr_shift_regs[i] <<= 1;
-					tile_attr_shift_regs[i] |= attr_latch[i] * 0x1;
-				}
+				tile_attr_shift_regs[i] <<= 1;
+				tile_attr_shift_regs[i] |= attr_latch[i] * 0x1;
 			}
+		}
 
-			// Draw pixel at dot
-			if ( scan_cycle >= 1 && scan_cycle <= 256 && scanline >= 0 && scanline <= 239 )
-			{
-				// Get bgr color
-				if ( render_bgr && (scan_cycle > 8 || render_bgr_l) )
-				{
-					u8 col = (((tile_shift_regs[1] >> (15 - x)) & 0x1) << 1) |
-					              ((tile_shift_regs[0] >> (15 - x)) & 0x1);
+		if ( actions & DRAW )
+		{
+			draw_dot( actions & FLUSH );
+		}
 
-					u8 attr = (((tile_attr_shift_regs[1] >> (15 - x)) & 0x1) << 1) |
-					               ((tile_attr_shift_regs[0] >> (15 - x)) & 0x1);
-					if ( col != 0 )
-					{
-						bgr_rgb = col_to_rgb( attr, col, false );
-					}
-				}
+		if ( actions & CLEAR_OAM2 )
+		{
+			oam2[scan_cycle / 2 - 1] = 0xFF;
+		}
+		else if ( actions & EVAL_SPRITES )
+		{
+			evaluate_sprites();
+		}
 
-				// Get spr color
-				bool sprite_0 = false;
-				if ( render_spr && (scan_cycle > 8 || render_spr_l) )
-				{
-					Tile tile;
-					u16 pattern_table = (regs[PPUCTRL] >> 3) & 0x1 ? 0x1000 : 0x0;
+		if ( actions & SPRITE_FETCH )
+		{
+			// For last 4 cycles, fetch the sprite data
+			u16 pattern_table = (regs[ PPUCTRL ] >> 3) & 0x1 ? 0x1000 : 0x0;
+			Sprite sprite = scanline_sprites[ (scan_cycle - 260) / 8 ];
+			if ( (regs[PPUCTRL] >> 5) & 0x1 )
+			{
+				pattern_table = 0x1000 * (sprite[ SPRITE::TILE ] & 0x1);
+			}
+			set_a12( pattern_table + sprite[ SPRITE::TILE ] * 16 );
+		}
 
-					for ( int s = 0; scanline != 0 && s < inrange_sprites; s++ )
-					{
-						Sprite sprite = scanline_sprites[s];
-						if ( tall_sprites )
-						{
-							pattern_table = 0x1000 * (sprite[SPRITE::TILE] & 0x1);
-						}
-						int dx = (scan_cycle - 1) - sprite[SPRITE::X];
-						int dy = scanline - (sprite[SPRITE::Y] + 1);
+		// Move vertical bits from temp VRAM address at end of vblank
+		if ( actions & COPY_VERT )
+		{
+			v = (v & ~0x7BE0) | (t & 0x7BE0);
+		}
 
-						if ( dx >= 0 && dx <= 7 && dy >= 0 && dy <= (tall_sprites ? 15 : 7) )
-						{
-							u8 tile_num = sprite[SPRITE::TILE];
-							bool flip_x = (sprite[SPRITE::ATTR] >> 6) & 0x1;
-							bool flip_y = (sprite[SPRITE::ATTR] >> 7) & 0x1;
+		if ( actions & FETCH )
+		{
+			fetch_tile( actions & PREFETCH_SHIFT );
+		}
 
-							if ( tall_sprites )
-							{
-								tile_num &= ~0x1;
-							}
-							if ( tall_sprites && flip_y != (dy >= 8) )
-							{
-								tile_num++;
-							}
+		if ( actions & INC_Y )
+		{
+			increment_y();
+		}
+		else if ( actions & COPY_HORIZ )
+		{ // Move horizontal bits from temp VRAM address
+			v = (v & ~0x041F) | (t & 0x041F);
+		}
+	}
+	else if ( !do_render )
+	{
+		if ( (actions & DRAW) && renders_frame( frame ) )
+		{
+			// Background palette_data hack, otherwise nothing is output
+			u16 index = (v & 0x3F00) == 0x3F00 ? read( v ) : PIXEL_BLANK;
+			nes->get_frame_buffer()->set_pixel( scan_cycle - 1, scanline, index );
+		}
+		set_a12( v );
+	}
 
-							u16 tile_addr = pattern_table + tile_num * 16;
+	if ( mapper->watches_a12() )
+	{
+		check_rising_edge();
+	}
 
-							for ( int b = 0; b < 16; b++ )
-							{
-								tile[b % 8][b / 8] = read( tile_addr + b );
-							}
-							u8 col_at_pos = tile_col_at_pixel( tile, dx, dy % 8, flip_x, flip_y );
+	scan_cycle++;
+	if ( scan_cycle > 340 || (do_render && scan_cycle == 340 && scanline == -1 && frame % 2 != 0) )
+	{
+		scan_cycle = 0;
+		scanline++;
+	}
+	if ( scanline > 260 )
+	{
+		scanline = -1;
+		// The frame count went up at line 240, after the last line of this one
+		if ( renders_frame( frame - 1 ) )
+		{
+			nes->get_frame_buffer()->push( rgb_palette );
+		}
+	}
+	if ( scanline == 240 && scan_cycle == 0 )
+	{
+		frame++;
+	}
 
-							if ( col_at_pos != 0 )
-							{
-								spr_rgb = col_to_rgb( sprite[SPRITE::ATTR], col_at_pos, true );
-								spr_priority = ((sprite[SPRITE::ATTR] >> 5) & 0x1) == 0;
-
-								bool is_sprite0 = true;
-								if ( (regs[PPUSTATUS] & 0x40) != 0x40 )
-								{
-									for ( int i = 0; i < 4; i++ )
-									{
-										if ( sprite[i] != this->sprite( 0 )[i] )
-										{
-											is_sprite0 = false;
-											break;
-										}
-									}
-								}
-								sprite_0 = is_sprite0;
-								break;
-							}
-						}
-					}
-				}
+	return true;
+}
 
-				// Multiplex bgr and spr color
-				u8 *final_rgb;
-				if ( bgr_rgb != nullptr || spr_rgb != nullptr )
-				{
-					if ( bgr_rgb == nullptr )
-					{
-						final_rgb = spr_rgb;
-					}
-					else if ( spr_rgb == nullptr )
-					{
-						final_rgb = bgr_rgb;
-					}
-					else
-					{
-						final_rgb = (spr_priority) ? spr_rgb : bgr_rgb;
-						if ( sprite_0 )
-						{
-							regs[PPUSTATUS] |= 0x40;
-						}
-					}
-				}
-				else
-				{
-					final_rgb = bgr_base_rgb();
-				}
+void PPU::draw_dot( bool line_end_dot )
+{
+	// Nothing is drawn on a skipped frame, and once sprite 0 has hit nothing else can come of its pixels
+	bool skip = !renders_frame( frame );
+	if ( skip && (regs[PPUSTATUS] & 0x40) )
+	{
+		return;
+	}
 
-				u8 rgb_cpy[3];
-				std::copy(final_rgb, final_rgb + 3, rgb_cpy);
-				if (emphasis_r)
-				{
-					rgb_cpy[1] *= 0.85;
-					rgb_cpy[2] *= 0.85;
-				}
-				if (emphasis_g)
-				{
-					rgb_cpy[0] *= 0.85;
-					rgb_cpy[2] *= 0.85;
-				}
-				if (emphasis_b)
-				{
-					rgb_cpy[0] *= 0.85;
-					rgb_cpy[1] *= 0.85;
-				}
+	bool render_bgr_l = (regs[PPUMASK] >> 1) & 0x1;
+	bool render_spr_l = (regs[PPUMASK] >> 2) & 0x1;
+	bool render_bgr = (regs[PPUMASK] >> 3) & 0x1;
+	bool render_spr = (regs[PPUMASK] >> 4) & 0x1;
 
-				nes->get_display()->set_pixel_buffer( scan_cycle - 1, scanline, rgb_cpy );
-			}
+	// Get bgr color
+	u8 bgr_key = 0;
+	if ( render_bgr && (scan_cycle > 8 || render_bgr_l) )
+	{
+		u8 col = (tile_shift >> (30 - 2 * x)) & 0x3;
+
+		u8 attr = (((tile_attr_shift_regs[1] >> (15 - x)) & 0x1) << 1) |
+		               ((tile_attr_shift_regs[0] >> (15 - x)) & 0x1);
+		if ( col != 0 )
+		{
+			bgr_key = attr * 4 + col;
 		}
+	}
 
-		// Sprite evaluation
-		if ( scanline != -1 && scanline <= 239 )
+	if ( skip )
+	{
+		if ( bgr_key != 0 && render_spr && (scan_cycle > 8 || render_spr_l) && scanline != 0 )
 		{
-			// Clear oam2 from cycles 1-64
-			if ( scan_cycle >= 1 && scan_cycle <= 64 && scan_cycle % 2 == 0 )
+			u8 spr = spr_line[scan_cycle - 1];
+			if ( (spr & 0x3) != 0 && (spr & SPR_ZERO) != 0 )
 			{
-				oam2[scan_cycle / 2 - 1] = 0xFF;
-			}
-			else if ( scan_cycle == 257 )
-			{
-				inrange_sprites = 0;
-				//TODO maybe add optional support for bypassing 8-sprite limit
-				int n = 0;
-				for ( ; n < 64; n++ )
-				{
-					Sprite spr = sprite( n );
-					u8 y = spr[SPRITE::Y];
-					if ( y <= scanline && (scanline - y) < (tall_sprites ? 16 : 8) )
-					{
-						for ( int i = 0; i < 4; i++ )
-						{
-							oam2[inrange_sprites * 4 + i] = spr[i];
-						}
-						inrange_sprites++;
-					}
-					if ( inrange_sprites == 8 )
-					{
-						break;
-					}
-				}
-				// We emulate the hardware bug and treat each byte of the remaining sprites as a y-coordinate
-				for ( ; n < 64; n++ )
-				{
-					for ( int m = 0; m < 4; m++ )
-					{
-						u8 faux_y = oam[n * 4 + m];
-						if ( faux_y <= scanline && (scanline - faux_y) < (tall_sprites ? 16 : 8) )
-						{
-							regs[PPUSTATUS] |= 0x20;
-						}
-						else
-						{
-							n++;
-							m++;
-						}
-					}
-				}
-				for ( int s = 0; s < 8; s++ )
-				{
-					for ( int i = 0; i < 4; i++ )
-					{
-						scanline_sprites[s][i] = (s < inrange_sprites) ? oam2[s * 4 + i] : 0xFF;
-					}
-				}
+				regs[PPUSTATUS] |= 0x40;
 			}
 		}
+		return;
+	}
 
-		if ( scanline <= 239 && scan_cycle >= 257 && scan_cycle <= 320 )
+	if ( line_renderer )
+	{
+		// Only record the background color; sprites and palette are resolved a run of pixels at a time
+		if ( line_start == line_end )
 		{
-			if ( (scan_cycle - 257) % 8 >= 4 )
-			{
-				// For last 4 cycles, fetch the sprite data
-				u16 pattern_table = (regs[ PPUCTRL ] >> 3) & 0x1 ? 0x1000 : 0x0;
-				Sprite sprite = scanline_sprites[ (scan_cycle - 260) / 8 ];
-				if ( tall_sprites )
-				{
-					pattern_table = 0x1000 * (sprite[ SPRITE::TILE ] & 0x1);
-				}
-				set_a12( pattern_table + sprite[ SPRITE::TILE ] * 16 );
-			}
+			line_start = scan_cycle - 1;
 		}
+		bgr_line[scan_cycle - 1] = bgr_key;
+		line_end = scan_cycle;
 
-		// Move vertical bits from temp VRAM address at end of vblank
-		if ( scanline == -1 && scan_cycle >= 280 && scan_cycle <= 304 )
+		if ( line_end_dot )
 		{
-			v = (v & ~0x7BE0) | (t & 0x7BE0);
+			flush_line();
 		}
+		return;
+	}
 
-		if ( scanline < 240 )
+	// Get spr color
+	u8 spr_key = 0;
+	bool spr_priority = false;
+	bool sprite_0 = false;
+	if ( render_spr && (scan_cycle > 8 || render_spr_l) && scanline != 0 )
+	{
+		u8 spr = spr_line[scan_cycle - 1];
+		if ( (spr & 0x3) != 0 )
 		{
-			// Every 8 dots, increment coarse X and update shift registers
-			if ( (scan_cycle - 2) % 8 == 7 && (scan_cycle >= 329 || scan_cycle <= 257) )
-			{
-				if ( scan_cycle >= 329 )
-				{
-					for ( int n = 0; n < 8; n++ )
-					{
-						for ( int i = 0; i < 2; i++ )
-						{
-							tile_shift_regs[i] <<= 1;
-							tile_attr_shift_regs[i] <<= 1;
-							tile_attr_shift_regs[i] |= attr_latch[i] * 0x1;
-						}
-					}
-				}
+			spr_key = 0x10 | (spr & 0xF);
+			spr_priority = (spr & SPR_FRONT) != 0;
+			sprite_0 = (spr & SPR_ZERO) != 0;
+		}
+	}
 
-				u16 next_tile_addr = 0x2000 | (v & 0x0FFF);
-				u16 next_attr_addr = 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
+	// Multiplex bgr and spr color, 0 being the backdrop
+	u8 key = bgr_key != 0 ? bgr_key : spr_key;
+	if ( bgr_key != 0 && spr_key != 0 )
+	{
+		key = spr_priority ? spr_key : bgr_key;
+		if ( sprite_0 )
+		{
+			regs[PPUSTATUS] |= 0x40;
+		}
+	}
 
-				u8 next_tile = read( next_tile_addr );
-				u8 next_attr = read( next_attr_addr );
+	nes->get_frame_buffer()->set_pixel( scan_cycle - 1, scanline, pixel_index( key ) );
+}
 
-				int quadrant_shift = 0;
-				bool x_high = (v >> 1) & 0x1;
-				bool y_high = (v >> 6) & 0x1;
-				if ( x_high )
-				{
-					quadrant_shift += 2;
-				}
-				if ( y_high )
-				{
-					quadrant_shift += 4;
-				}
-				attr_latch[0] = (next_attr >> quadrant_shift) & 0x1;
-				attr_latch[1] = (next_attr >> quadrant_shift >> 1) & 0x1;
+// Bit n set for each of the 64 sprites in OAM whose Y puts it on the line
+static u64 sprites_in_range( const u8 *oam, int line, int height )
+{
+#ifdef PPU_SSE2
+	const __m128i y_mask = _mm_set1_epi32( 0xFF );
+	const __m128i line_v = _mm_set1_epi8( (char)line );
+	const __m128i last_row = _mm_set1_epi8( (char)(height - 1) );
+	u64 mask = 0;
+	for ( int group = 0; group < 4; group++ )
+	{
+		// Pack the Y bytes, the first of each sprite's 4, of 16 sprites into one vector
+		const __m128i *src = (const __m128i *)(oam + group * 64);
+		__m128i lo = _mm_packs_epi32( _mm_and_si128( _mm_loadu_si128( src ), y_mask ),
+		                              _mm_and_si128( _mm_loadu_si128( src + 1 ), y_mask ) );
+		__m128i hi = _mm_packs_epi32( _mm_and_si128( _mm_loadu_si128( src + 2 ), y_mask ),
+		                              _mm_and_si128( _mm_loadu_si128( src + 3 ), y_mask ) );
+		__m128i y = _mm_packus_epi16( lo, hi );
+
+		// Unsigned y <= line, and line - y <= height - 1
+		__m128i above = _mm_cmpeq_epi8( _mm_max_epu8( y, line_v ), line_v );
+		__m128i row = _mm_sub_epi8( line_v, y );
+		__m128i within = _mm_cmpeq_epi8( _mm_min_epu8( row, last_row ), row );
+		mask |= (u64)(u16)_mm_movemask_epi8( _mm_and_si128( above, within ) ) << (group * 16);
+	}
+	return mask;
+#else
+	u64 mask = 0;
+	for ( int n = 0; n < 64; n++ )
+	{
+		u8 y = oam[n * 4];
+		if ( y <= line && (line - y) < height )
+		{
+			mask |= (u64)1 << n;
+		}
+	}
+	return mask;
+#endif
+}
 
-				for ( int n = 0; n < 8; n++ )
-				{
-					for ( int i = 0; i < 2; i++ )
-					{
-						tile_attr_shift_regs[i] <<= 1;
-						tile_attr_shift_regs[i] |= attr_latch[i] * 0x1;
-					}
-				}
+void PPU::evaluate_sprites()
+{
+	bool tall_sprites = (regs[PPUCTRL] >> 5) & 0x1;
+	u64 in_range = sprites_in_range( oam, scanline, tall_sprites ? 16 : 8 );
+	bool zero_in_range = in_range & 0x1;
+	//TODO maybe add optional support for bypassing 8-sprite limit
+	inrange_sprites = 0;
+	for ( u64 left = in_range; left != 0 && inrange_sprites < 8; left &= left - 1 )
+	{
+		Sprite spr = sprite( std::countr_zero( left ) );
+		for ( int i = 0; i < 4; i++ )
+		{
+			oam2[inrange_sprites * 4 + i] = spr[i];
+		}
+		inrange_sprites++;
+	}
+	// The overflow search, with the hardware bug that treats other bytes of the remaining sprites as Y, starts
+	// from the 8th sprite found, whose Y is always in range; so the flag is set whenever there are 8
+	if ( std::popcount( in_range ) >= 8 )
+	{
+		regs[PPUSTATUS] |= 0x20;
+	}
+	for ( int s = 0; s < 8; s++ )
+	{
+		for ( int i = 0; i < 4; i++ )
+		{
+			scanline_sprites[s][i] = (s < inrange_sprites) ? oam2[s * 4 + i] : 0xFF;
+		}
+	}
+	// Sprite tiles are still fetched for the code/data log
+	build_sprite_line( zero_in_range, !renders_frame( frame ) && cdl == nullptr );
+}
 
-				u16 pattern_addr =
-						0x1000 * ((regs[PPUCTRL] >> 4) & 0x1) + ((u16) next_tile << 4) + ((v & 0x7000) >> 12);
-				tile_shift_regs[0] = tile_shift_regs[0] & 0xFF00 | (read( pattern_addr ));
-				tile_shift_regs[1] = tile_shift_regs[1] & 0xFF00 | (read( pattern_addr + 8 ));
+void PPU::fetch_tile( bool prefetch )
+{
+	if ( prefetch )
+	{
+		tile_shift <<= 16;
+		for ( int n = 0; n < 8; n++ )
+		{
+			for ( int i = 0; i < 2; i++ )
+			{
+				tile_attr_shift_regs[i] <<= 1;
+				tile_attr_shift_regs[i] |= attr_latch[i] * 0x1;
+			}
+		}
+	}
 
-				set_a12( pattern_addr );
+	u16 next_tile_addr = 0x2000 | (v & 0x0FFF);
+	u16 next_attr_addr = 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
 
-				if ( (v & 0x001F) == 31 )
-				{
-					v &= ~0x001F;
-					v ^= 0x0400;
-				}
-				else
-				{
-					v += 1;
-				}
-			}
+	u8 next_tile = fetch( next_tile_addr );
+	u8 next_attr = fetch( next_attr_addr );
 
-			// Increment fine Y at end of line and wrap around
-			if ( scan_cycle == 256 )
-			{
-				if ( (v & 0x7000) != 0x7000 )
-				{
-					v += 0x1000;
-				}
-				else
-				{
-					v &= ~0x7000;
-					int y = (v >> 5) & 0x1F;
-					if ( y == 29 )
-					{
-						y = 0;
-						v ^= 0x800;
-					}
-					else if ( y == 31 )
-					{
-						y = 0;
-					}
-					else
-					{
-						y += 1;
-					}
+	int quadrant_shift = 0;
+	bool x_high = (v >> 1) & 0x1;
+	bool y_high = (v >> 6) & 0x1;
+	if ( x_high )
+	{
+		quadrant_shift += 2;
+	}
+	if ( y_high )
+	{
+		quadrant_shift += 4;
+	}
+	attr_latch[0] = (next_attr >> quadrant_shift) & 0x1;
+	attr_latch[1] = (next_attr >> quadrant_shift >> 1) & 0x1;
 
-					v = (v & ~0x03E0) | (y << 5);
-				}
-			}
-			else if ( scan_cycle == 257 )
-			{ // Move horizontal bits from temp VRAM address
-				v = (v & ~0x041F) | (t & 0x041F);
-			}
+	for ( int n = 0; n < 8; n++ )
+	{
+		for ( int i = 0; i < 2; i++ )
+		{
+			tile_attr_shift_regs[i] <<= 1;
+			tile_attr_shift_regs[i] |= attr_latch[i] * 0x1;
 		}
 	}
+
+	u16 pattern_addr =
+			0x1000 * ((regs[PPUCTRL] >> 4) & 0x1) + ((u16) next_tile << 4) + ((v & 0x7000) >> 12);
+	tile_shift = (tile_shift & 0xFFFF0000) | fetch_row( pattern_addr );
+
+	set_a12( pattern_addr );
+
+	if ( (v & 0x001F) == 31 )
+	{
+		v &= ~0x001F;
+		v ^= 0x0400;
+	}
 	else
 	{
-		if ( (v & 0x3F00) == 0x3F00 && scan_cycle >= 1 && scan_cycle <= 256 && scanline >= 0 && scanline <= 239 )
+		v += 1;
+	}
+}
+
+void PPU::increment_y()
+{
+	// Increment fine Y at end of line and wrap around
+	if ( (v & 0x7000) != 0x7000 )
+	{
+		v += 0x1000;
+	}
+	else
+	{
+		v &= ~0x7000;
+		int y = (v >> 5) & 0x1F;
+		if ( y == 29 )
 		{
-			// Background palette_data hack
-			nes->get_display()->set_pixel_buffer( scan_cycle - 1, scanline, rgb_palette[ read( v ) ] );
+			y = 0;
+			v ^= 0x800;
 		}
-		set_a12( v );
+		else if ( y == 31 )
+		{
+			y = 0;
+		}
+		else
+		{
+			y += 1;
+		}
+
+		v = (v & ~0x03E0) | (y << 5);
 	}
+}
 
-	check_rising_edge();
+void PPU::build_sprite_line( bool zero_in_range, bool zero_only )
+{
+	// Like the sprite shift registers, fetch the next line's sprite patterns once, here at dot 257, with
+	// lower OAM indices taking precedence where opaque pixels overlap
+	bool tall_sprites = (regs[PPUCTRL] >> 5) & 0x1;
+	std::fill( spr_line, spr_line + 256, 0 );
+	int sprites = !zero_only ? inrange_sprites : zero_in_range && !(regs[PPUSTATUS] & 0x40) ? 1 : 0;
+	for ( int s = 0; s < sprites; s++ )
+	{
+		Sprite sprite = scanline_sprites[s];
+		int dy = scanline - sprite[SPRITE::Y];
+		if ( dy < 0 || dy > (tall_sprites ? 15 : 7) )
+		{
+			continue;
+		}
 
-	scan_cycle++;
-	if ( scan_cycle > 340 || (do_render && scan_cycle == 340 && scanline == -1 && frame % 2 != 0) )
+		u16 pattern_table = (regs[PPUCTRL] >> 3) & 0x1 ? 0x1000 : 0x0;
+		u8 tile_num = sprite[SPRITE::TILE];
+		bool flip_x = (sprite[SPRITE::ATTR] >> 6) & 0x1;
+		bool flip_y = (sprite[SPRITE::ATTR] >> 7) & 0x1;
+		if ( tall_sprites )
+		{
+			pattern_table = 0x1000 * (tile_num & 0x1);
+			tile_num &= ~0x1;
+		}
+		if ( tall_sprites && flip_y != (dy >= 8) )
+		{
+			tile_num++;
+		}
+		u16 row_addr = pattern_table + tile_num * 16 + (flip_y ? 7 - dy % 8 : dy % 8);
+		u16 row = fetch_row( row_addr );
+
+		u8 flags = (sprite[SPRITE::ATTR] & 0x3) << 2;
+		flags |= ((sprite[SPRITE::ATTR] >> 5) & 0x1) == 0 ? SPR_FRONT : 0;
+		flags |= (s == 0 && zero_in_range) ? SPR_ZERO : 0;
+		for ( int dx = 0; dx < 8 && sprite[SPRITE::X] + dx < 256; dx++ )
+		{
+			int pixel = flip_x ? 7 - dx : dx;
+			u8 col = (row >> (14 - 2 * pixel)) & 0x3;
+			u8 &entry = spr_line[sprite[SPRITE::X] + dx];
+			if ( col != 0 && (entry & 0x3) == 0 )
+			{
+				entry = flags | col;
+			}
+		}
+	}
+}
+
+void PPU::flush_line()
+{
+	if ( line_start == line_end )
 	{
-		scan_cycle = 0;
-		scanline++;
+		return;
 	}
-	if ( scanline > 260 )
+
+	bool render_spr_l = (regs[PPUMASK] >> 2) & 0x1;
+	bool render_spr = (regs[PPUMASK] >> 4) & 0x1;
+
+	u8 colors[32];
+	for ( int key = 0; key < 32; key++ )
 	{
-		scanline = -1;
-		nes->get_display()->push_buffer();
+		colors[key] = read( 0x3F00 + key ) & (regs[PPUMASK] & 0x1 ? 0x30 : 0x3F);
 	}
-	if ( scanline == 240 && scan_cycle == 0 )
+
+	Compositor::Run run;
+	run.bgr = bgr_line;
+	run.spr = spr_line;
+	run.start = line_start;
+	run.end = line_end;
+	run.spr_from = !render_spr || scanline == 0 ? 256 : render_spr_l ? 0 : 8;
+	run.colors = colors;
+	run.emphasis = (regs[PPUMASK] >> 5) << PIXEL_EMPHASIS_SHIFT;
+	run.out = nes->get_frame_buffer()->get_row( scanline );
+	if ( Compositor::compose( run ) )
 	{
-		frame++;
+		regs[PPUSTATUS] |= 0x40;
 	}
 
-	return true;
+	line_start = line_end;
+}
+
+u16 PPU::pixel_index( u8 key )
+{
+	u8 col = read( 0x3F00 + key );
+	if ( (regs[PPUMASK] >> 0) & 0x1 )
+	{
+		col &= 0x30;
+	} //grayscale effect
+	return col | ((regs[PPUMASK] >> 5) << PIXEL_EMPHASIS_SHIFT);
+}
+
+void PPU::set_render_interval( int interval )
+{
+	// Don't leave half a line for a frame that isn't drawn
+	flush_line();
+	render_interval = std::max( interval, 0 );
+}
+
+long PPU::dots_until( short line, short dot ) const
+{
+	// Number of run() calls before the one at (line, dot), never overestimated
+	long dots = (line - scanline) * 341L + (dot - scan_cycle);
+	if ( dots < 0 )
+	{
+		dots += 262 * 341;
+	}
+	// The odd frame skip on the pre-render line may drop a dot along the way
+	return dots > 0 ? dots - 1 : 0;
 }
 
 u16 PPU::mirror_palette_addr( u16 addr )
@@ -428,6 +624,10 @@ u8 PPU::read_reg( u8 reg_id, int cycle, bool physical_read )
 		{
 			io_bus = vram_read_buffer;
 			vram_read_buffer = read( v & 0x3FFF );
+			if ( cdl != nullptr && (v & 0x3FFF) < 0x3F00 )
+			{
+				cdl->mark_chr( mapper->chr_rom_offset( vram( v & 0x3FFF ) ), CodeDataLog::READ );
+			}
 			v += ((regs[PPUCTRL] >> 2) & 0x1) ? 32 : 1;
 		}
 		else if ( reg_id == OAMDATA )
@@ -510,18 +710,6 @@ Sprite PPU::sprite( u8 index )
 	return &oam[index * 4];
 }
 
-u8 PPU::tile_col_at_pixel( Tile tile, int dx, int dy, bool flip_x, bool flip_y )
-{
-	u8 x = flip_x ? (7 - dx) : dx;
-	u8 y = flip_y ? (7 - dy) : dy;
-
-	bool val1 = tile[y][0] >> (7 - x) & 0x1;
-	bool val2 = tile[y][1] >> (7 - x) & 0x1;
-	u8 color = (val2 << 1) | val1;
-
-	return color;
-}
-
 void PPU::set_palette( std::string palFileName )
 {
 	std::ifstream palFile( palFileName );
@@ -563,6 +751,7 @@ u8 *PPU::col_to_rgb( u8 attr, u8 col, bool spr )
 	return rgb;
 }
 
+#ifndef NESPRIME_HEADLESS
 void PPU::output_pt()
 {
 	for ( int i = 0; i < 2; i++ )
@@ -572,12 +761,11 @@ void PPU::output_pt()
 			u16 pattern_addr = (i << 12) + (n << 4);
 			for ( int y = 0; y < 8; y++ )
 			{
-				u8 p1 = read( pattern_addr + y );
-				u8 p2 = read( pattern_addr + y + 8 );
+				u16 row = mapper->tile_row( pattern_addr + y );
 
 				for ( int cx = 0; cx < 8; cx++ )
 				{
-					u8 col = ((p1 >> (7 - cx) & 0x1)) | ((p2 >> (7 - cx) & 0x1) << 1);
+					u8 col = (row >> (14 - 2 * cx)) & 0x3;
 					u8 rgb[3] = {0, 0, 0};
 					if ( col != 0 )
 					{
@@ -603,11 +791,6 @@ void PPU::output_nt()
 			{
 				u8 tile_num = read( 0x2000 + 0x400 * i + y * 32 + cx );
 				u16 pattern_idx = 0x1000 * ((regs[PPUCTRL] >> 4) & 0x1) + ((u16) tile_num << 4);
-				Tile tile;
-				for ( int b = 0; b < 16; b++ )
-				{
-					tile[b % 8][b / 8] = read( pattern_idx + b );
-				}
 
 				u16 attr = read( 0x23C0 + 0x400 * i + (y / 4) * 8 + (cx / 4) % 8 );
 				u8 attr_bitshift = 0;
@@ -622,9 +805,10 @@ void PPU::output_nt()
 
 				for ( int fine_y = 0; fine_y < 8; fine_y++ )
 				{
+					u16 row = mapper->tile_row( pattern_idx + fine_y );
 					for ( int fine_x = 0; fine_x < 8; fine_x++ )
 					{
-						u8 col = tile_col_at_pixel( tile, fine_x, fine_y, false, false );
+						u8 col = (row >> (14 - 2 * fine_x)) & 0x3;
 						u8 *rgb = col != 0 ? col_to_rgb( attr >> attr_bitshift, col, false ) : bgr_base_rgb();
 						u8 rgb_cpy[ 3 ];
 						memcpy( rgb_cpy, rgb, 3 );
@@ -645,6 +829,7 @@ void PPU::output_nt()
 	}
 	nes->get_display()->update_nt();
 }
+#endif
 
 u8 PPU::read( int addr )
 {
@@ -654,7 +839,8 @@ u8 PPU::read( int addr )
 	}
 	else
 	{
-		return *mapper->map_ppu( addr );
+		// Not fetch(), so the debug viewers reading through here don't count as rendering
+		return *vram( addr );
 	}
 }
 
@@ -664,13 +850,54 @@ bool PPU::write( const u16 addr, const u8 data )
 	{
 		palette[mirror_palette_addr( addr )] = data;
 	}
-	else
+	else if ( addr >= 0x2000 )
 	{
-		*mapper->map_ppu( addr ) = data;
+		*vram( addr ) = data;
+	}
+	else if ( mapper->has_chr_ram() )
+	{
+		// Pattern tables on CHR ROM can't be written
+		*vram( addr ) = data;
+		mapper->get_tile_cache()->update( vram( addr ) );
 	}
 	return true;
 }
 
+void PPU::serialize( SaveState &save )
+{
+	Processor::serialize( save );
+	save.io( oam );
+	save.io( oam2 );
+	save.io( palette );
+	save.io( regs );
+	save.io( io_bus );
+	save.io( scanline );
+	save.io( scan_cycle );
+	save.io( frame );
+	save.io( dots );
+	save.io( inrange_sprites );
+	save.io( scanline_sprites );
+	save.io( v );
+	save.io( t );
+	save.io( x );
+	save.io( w );
+	save.io( tile_shift );
+	save.io( tile_attr_shift_regs );
+	save.io( attr_latch );
+	save.io( nmi_occurred );
+	save.io( nmi_output );
+	save.io( vram_read_buffer );
+	save.io( spr_line );
+	save.io( bgr_line );
+	save.io( line_start );
+	save.io( line_end );
+	save.io( a12 );
+	save.io( a12_set );
+	save.io( a12_low_cycles );
+	save.io( a12_rising_filter );
+	save.io( m2_counter );
+}
+
 void PPU::check_rising_edge()
 {
 	if ( ++m2_counter == 3 )
@@ -691,7 +918,7 @@ void PPU::check_rising_edge()
 		{
 			if ( !a12_rising_filter )
 			{
-				mapper->handle_ppu_rising_edge();
+				mapper->ppu_rising_edge();
 			}
 			a12_low_cycles = 0;
 			a12_rising_filter = true;
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Processor.h"
+#include "CodeDataLog.h"
+#include "Compositor.h"
 
 enum PPU_REG
 {
@@ -13,13 +15,31 @@ enum SPRITE
 	Y, TILE, ATTR, X
 };
 
-typedef u8 Tile[8][2];
-
 class PPU : public Processor
 {
 public:
 	PPU();
 
+	// What run() does on a dot, as looked up in its table by line and dot
+	enum DotAction : u16
+	{
+		SET_VBLANK = 1 << 0,
+		CLEAR_FLAGS = 1 << 1,
+		SHIFT = 1 << 2,
+		DRAW = 1 << 3,
+		FLUSH = 1 << 4,
+		CLEAR_OAM2 = 1 << 5,
+		EVAL_SPRITES = 1 << 6,
+		SPRITE_FETCH = 1 << 7,
+		COPY_VERT = 1 << 8,
+		FETCH = 1 << 9,
+		PREFETCH_SHIFT = 1 << 10,
+		INC_Y = 1 << 11,
+		COPY_HORIZ = 1 << 12,
+		// Everything that only happens while rendering is on
+		RENDER_ACTIONS = ~(SET_VBLANK | CLEAR_FLAGS) & 0xFFFF
+	};
+
 	~PPU()
 	{
 		std::fill( oam, oam + 256, 0 );
@@ -32,6 +52,14 @@ public:
 
 	bool run() override;
 
+	void serialize( SaveState &save ) override;
+
+	// Logs the CHR ROM bytes drawn and read through PPUDATA into cdl from now on, or stops if it is null
+	void set_cdl( CodeDataLog *cdl_to )
+	{
+		cdl = cdl_to;
+	}
+
 	u8 read_reg( u8 reg_id, int cycle );
 
 	u8 read_reg( u8 reg_id, int cycle, bool physical_read );
@@ -59,6 +87,11 @@ public:
 		return frame;
 	}
 
+	long get_dots() const
+	{
+		return dots;
+	}
+
 	u16 get_v() const
 	{
 		return v;
@@ -79,9 +112,35 @@ public:
 		return w;
 	}
 
+	long dots_until( short line, short dot ) const;
+
+	// Draws the pixels rendered since the last flush; must run before anything the CPU does to the PPU or mapper
+	void flush_line();
+
+	void set_line_renderer( bool enabled )
+	{
+		line_renderer = enabled;
+	}
+
+	bool get_line_renderer() const
+	{
+		return line_renderer;
+	}
+
+	// Draws one frame in every interval, or none at all for 0. The frames in between keep everything the game
+	// can tell, v-blank, sprite 0 hits, sprite overflow and the A12 edges mappers count, but produce no pixels
+	void set_render_interval( int interval );
+
+	int get_render_interval() const
+	{
+		return render_interval;
+	}
+
+#ifndef NESPRIME_HEADLESS
 	void output_pt();
 
 	void output_nt();
+#endif
 
 protected:
 	u8 read( int addr ) override;
@@ -91,30 +150,42 @@ protected:
 private:
 	static u16 mirror_palette_addr( u16 addr );
 
-	u8 oam[256];
-	u8 oam2[32];
+	// Pattern and nametable fetch straight from the mapper's page table, for addresses below $3F00
+	u8 fetch( u16 addr );
+
+	// Pattern row fetch as a decoded tile cache row, for addresses below $2000
+	u16 fetch_row( u16 addr );
+
+	u8 *vram( u16 addr );
+
+	CodeDataLog *cdl = nullptr;
+
+	u8 oam[256] = { 0 };
+	u8 oam2[32] = { 0 };
 	u8 palette[32];
-	u8 regs[8];
+	u8 regs[8] = { 0 };
 
-	u8 io_bus;
+	u8 io_bus = 0;
 
 	short scanline = 0;
 	short scan_cycle = 3;
 	long frame = 1;
+	long dots = 0;
 
 	int inrange_sprites = 0;
-	u8 scanline_sprites[8][4];
+	u8 scanline_sprites[8][4] = { };
 
 	u8 rgb_palette[64][3];
 
 	//internal registers
-	u16 v, t;
-	u8 x;
-	bool w; // address latch
+	u16 v = 0, t = 0;
+	u8 x = 0;
+	bool w = false; // address latch
 
-	u16 tile_shift_regs[2];
-	u16 tile_attr_shift_regs[2];
-	bool attr_latch[2];
+	// Both pattern planes of two tiles as 2-bit colors, the tile being drawn in the top half
+	u32 tile_shift = 0;
+	u16 tile_attr_shift_regs[2] = { 0 };
+	bool attr_latch[2] = { false };
 
 	bool nmi_occurred = false;
 	bool nmi_output = false;
@@ -123,12 +194,47 @@ private:
 
 	Sprite sprite( u8 index );
 
-	static u8 tile_col_at_pixel( Tile tile, int dx, int dy, bool flip_x, bool flip_y );
-
 	u8 *bgr_base_rgb();
 
 	u8 *col_to_rgb( u8 attr, u8 col, bool spr );
 
+	// Framebuffer pixel for a palette offset from $3F00, with grayscale and emphasis applied
+	u16 pixel_index( u8 key );
+
+	// The parts of run() done on some dots of a line
+	void draw_dot( bool line_end_dot );
+
+	void evaluate_sprites();
+
+	void fetch_tile( bool prefetch );
+
+	void increment_y();
+
+	// zero_only leaves out every sprite but sprite 0, for frames that aren't drawn
+	void build_sprite_line( bool zero_in_range, bool zero_only );
+
+	// Whether the frame numbered f is drawn
+	bool renders_frame( long f ) const
+	{
+		return render_interval == 1 || (render_interval != 0 && f % render_interval == 0);
+	}
+
+	int render_interval = 1;
+
+	// Pre-decoded sprite pixels of the current line: bits 0-1 color, 2-3 palette, plus the flags below
+	enum : u8
+	{
+		SPR_FRONT = Compositor::SPR_FRONT, SPR_ZERO = Compositor::SPR_ZERO
+	};
+	u8 spr_line[256] = { 0 };
+
+	// Scanline renderer: background colors are recorded per dot, and the pixels of a line are only composed
+	// at dot 256 or when the CPU is about to touch the PPU mid-line
+	bool line_renderer = true;
+	u8 bgr_line[256] = { 0 };
+	short line_start = 0;
+	short line_end = 0;
+
 	void set_a12( u16 addr )
 	{
 		if ( !a12_set )
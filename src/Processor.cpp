@@ -1,4 +1,5 @@
 #include "Processor.h"
+#include "SaveState.h"
 
 Processor::Processor()
 {
@@ -17,3 +18,10 @@ bool Processor::run()
 	idle_cycles = 0;
 	return true;
 }
+
+void Processor::serialize( SaveState &save )
+{
+	save.io( idle_cycles );
+	save.io( cycle );
+	save.io( mem );
+}
\ No newline at end of file
@@ -9,6 +9,8 @@
 
 class Mapper;
 
+class SaveState;
+
 class Processor : public Component
 {
 public:
@@ -20,6 +22,8 @@ public:
 
 	virtual bool run();
 
+	virtual void serialize( SaveState &save );
+
 	long get_cycle()
 	{
 		return cycle;
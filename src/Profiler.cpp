@@ -0,0 +1,211 @@
+#include "Profiler.h"
+#include "CPU.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+static const char *MODE_NAMES[] = {
+		"zp,X", "zp,Y", "abs,X", "abs,Y", "(zp,X)", "(zp),Y", "implied", "A", "#imm", "zp", "abs", "rel", "(abs)"
+};
+
+void Profiler::reset( size_t prg_size )
+{
+	key_cycles.assign( ROM_KEYS + prg_size, 0 );
+	key_count.assign( ROM_KEYS + prg_size, 0 );
+	key_pc.assign( ROM_KEYS + prg_size, 0 );
+	key_opcode.assign( ROM_KEYS + prg_size, 0 );
+	opcode_cycles.fill( 0 );
+	opcode_count.fill( 0 );
+	interrupt_cycles = 0;
+	dma_cycles = 0;
+	total_cycles = 0;
+	frames.assign( 1, Frame{ 0, CALL, 0, -1, 0, {} } );
+	reset_stack();
+}
+
+void Profiler::instruction( u16 pc, long rom, u8 opcode, long cycles )
+{
+	u32 key = rom < 0 ? pc : ROM_KEYS + rom;
+	key_cycles[key] += cycles;
+	key_count[key]++;
+	key_pc[key] = pc;
+	key_opcode[key] = opcode;
+	opcode_cycles[opcode] += cycles;
+	opcode_count[opcode]++;
+	frames[stack.back().frame].cycles += cycles;
+	total_cycles += cycles;
+}
+
+void Profiler::call( FrameKind kind, u16 target, long rom, u8 s )
+{
+	// Calls whose return addresses this one has pushed over are never coming back
+	while ( stack.size() > 1 && stack.back().s <= s )
+	{
+		stack.pop_back();
+	}
+	u32 frame = stack.back().frame;
+	u64 id = (u64)kind << 48 | (u64)target << 32 | (u32)(rom + 1);
+	auto it = frames[frame].children.find( id );
+	if ( it == frames[frame].children.end() )
+	{
+		frames.push_back( Frame{ frame, kind, target, rom, 0, {} } );
+		it = frames[frame].children.emplace( id, frames.size() - 1 ).first;
+	}
+	stack.push_back( { it->second, s } );
+}
+
+void Profiler::ret( u8 s )
+{
+	while ( stack.size() > 1 && stack.back().s < s )
+	{
+		stack.pop_back();
+	}
+}
+
+void Profiler::interrupt( long cycles )
+{
+	frames[stack.back().frame].cycles += cycles;
+	interrupt_cycles += cycles;
+	total_cycles += cycles;
+}
+
+void Profiler::dma( long cycles )
+{
+	dma_cycles += cycles;
+	total_cycles += cycles;
+}
+
+std::string Profiler::label( u16 pc, long rom )
+{
+	// Room for any bank number a long can hold
+	char text[24];
+	if ( rom < 0 )
+	{
+		snprintf( text, sizeof( text ), "RAM:%04X", pc );
+	}
+	else
+	{
+		snprintf( text, sizeof( text ), "%02lX:%04X", rom / BANK_SIZE, pc );
+	}
+	return text;
+}
+
+bool Profiler::write_flat( const std::string &path ) const
+{
+	std::ofstream out( path );
+	char line[128];
+	auto percent = [this]( u64 cycles ) { return total_cycles == 0 ? 0.0 : 100.0 * cycles / total_cycles; };
+
+	out << "Total cycles: " << total_cycles << "\n";
+	out << "Interrupt entry cycles: " << interrupt_cycles << "\n";
+	out << "OAM DMA cycles: " << dma_cycles << "\n\n";
+
+	std::vector< u32 > keys;
+	for ( u32 key = 0; key < key_cycles.size(); key++ )
+	{
+		if ( key_count[key] > 0 )
+		{
+			keys.push_back( key );
+		}
+	}
+	std::sort( keys.begin(), keys.end(), [this]( u32 a, u32 b ) { return key_cycles[a] > key_cycles[b]; } );
+	out << "By instruction (bank:address)\n";
+	out << "      cycles       %       count  where     instruction\n";
+	for ( u32 key : keys )
+	{
+		long rom = key < ROM_KEYS ? -1 : (long)(key - ROM_KEYS);
+		const opcode_info &info = CPU::get_opcode_info( key_opcode[key] );
+		snprintf( line, sizeof( line ), "%12llu  %6.2f  %10llu  %-8s  %-4s %s\n", (unsigned long long)key_cycles[key],
+		          percent( key_cycles[key] ), (unsigned long long)key_count[key], label( key_pc[key], rom ).c_str(),
+		          info.op_func == nullptr ? "???" : OP_NAMES[info.id], MODE_NAMES[info.mode] );
+		out << line;
+	}
+
+	std::vector< u64 > bank_cycles;
+	u64 ram_cycles = 0;
+	for ( u32 key = 0; key < key_cycles.size(); key++ )
+	{
+		if ( key < ROM_KEYS )
+		{
+			ram_cycles += key_cycles[key];
+			continue;
+		}
+		size_t bank = (key - ROM_KEYS) / BANK_SIZE;
+		if ( bank_cycles.size() <= bank )
+		{
+			bank_cycles.resize( bank + 1 );
+		}
+		bank_cycles[bank] += key_cycles[key];
+	}
+	out << "\nBy PRG bank (" << BANK_SIZE / 1024 << "KB)\n";
+	for ( size_t bank = 0; bank < bank_cycles.size(); bank++ )
+	{
+		snprintf( line, sizeof( line ), "%12llu  %6.2f  %02zX\n", (unsigned long long)bank_cycles[bank],
+		          percent( bank_cycles[bank] ), bank );
+		out << line;
+	}
+	snprintf( line, sizeof( line ), "%12llu  %6.2f  RAM\n", (unsigned long long)ram_cycles, percent( ram_cycles ) );
+	out << line;
+
+	std::array< u64, 13 > mode_cycles{};
+	std::array< u64, 13 > mode_count{};
+	std::vector< int > opcodes;
+	for ( int opcode = 0; opcode < 256; opcode++ )
+	{
+		if ( opcode_count[opcode] > 0 )
+		{
+			opcodes.push_back( opcode );
+			mode_cycles[CPU::get_opcode_info( opcode ).mode] += opcode_cycles[opcode];
+			mode_count[CPU::get_opcode_info( opcode ).mode] += opcode_count[opcode];
+		}
+	}
+	std::sort( opcodes.begin(), opcodes.end(), [this]( int a, int b ) { return opcode_cycles[a] > opcode_cycles[b]; } );
+	out << "\nBy opcode\n";
+	for ( int opcode : opcodes )
+	{
+		const opcode_info &info = CPU::get_opcode_info( opcode );
+		snprintf( line, sizeof( line ), "%12llu  %6.2f  %10llu  %02X %-4s %s\n", (unsigned long long)opcode_cycles[opcode],
+		          percent( opcode_cycles[opcode] ), (unsigned long long)opcode_count[opcode], opcode,
+		          info.op_func == nullptr ? "???" : OP_NAMES[info.id], MODE_NAMES[info.mode] );
+		out << line;
+	}
+
+	out << "\nBy addressing mode\n";
+	for ( int mode = 0; mode < 13; mode++ )
+	{
+		if ( mode_count[mode] > 0 )
+		{
+			snprintf( line, sizeof( line ), "%12llu  %6.2f  %10llu  %s\n", (unsigned long long)mode_cycles[mode],
+			          percent( mode_cycles[mode] ), (unsigned long long)mode_count[mode], MODE_NAMES[mode] );
+			out << line;
+		}
+	}
+	return out.good();
+}
+
+bool Profiler::write_collapsed( const std::string &path ) const
+{
+	static const char *KIND_NAMES[] = { "", "NMI ", "IRQ ", "BRK " };
+	std::ofstream out( path );
+	std::vector< std::string > names( frames.size() );
+	names[0] = "[root]";
+	// Children always come after their parents, so each name can build on its parent's
+	for ( size_t i = 1; i < frames.size(); i++ )
+	{
+		const Frame &f = frames[i];
+		names[i] = names[f.parent] + ";" + KIND_NAMES[f.kind] + label( f.pc, f.rom );
+	}
+	for ( size_t i = 0; i < frames.size(); i++ )
+	{
+		if ( frames[i].cycles > 0 )
+		{
+			out << names[i] << " " << frames[i].cycles << "\n";
+		}
+	}
+	if ( dma_cycles > 0 )
+	{
+		out << "[root];[OAM DMA] " << dma_cycles << "\n";
+	}
+	return out.good();
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "BitUtils.h"
+
+// Exact profile of the guest program: every CPU cycle is charged to the instruction that spent it, and through a
+// shadow call stack built from JSR/RTS and interrupts/RTI, to the chain of subroutines it ran under. Only built
+// with NESPRIME_PROFILER; without it the CPU has no hooks at all
+class Profiler
+{
+public:
+	enum FrameKind : u8
+	{
+		CALL, NMI, IRQ, BRK
+	};
+
+	// Sizes the counters for a ROM of prg_size bytes and forgets everything counted so far
+	void reset( size_t prg_size );
+
+	// The code that was running is unknown after a state load, so charge the next cycles from the root again
+	void reset_stack()
+	{
+		stack.assign( 1, { 0, 0x100 } );
+	}
+
+	// rom is the PRG ROM offset of the instruction, or -1 if it ran from RAM
+	void instruction( u16 pc, long rom, u8 opcode, long cycles );
+
+	// s is the stack pointer once the return address is pushed, or after it is pulled again. Calls are matched
+	// to returns by it rather than by count, so code that drops return addresses or resets the stack with TXS
+	// unwinds the shadow stack as well
+	void call( FrameKind kind, u16 target, long rom, u8 s );
+
+	void ret( u8 s );
+
+	// Cycles spent entering an interrupt handler, charged to the handler but to no instruction
+	void interrupt( long cycles );
+
+	// Cycles the CPU was halted for OAM DMA, charged to whatever was running
+	void dma( long cycles );
+
+	// A flat profile: totals, then cycles per instruction, per PRG bank and per opcode and addressing mode
+	bool write_flat( const std::string &path ) const;
+
+	// One line per distinct call stack with the cycles spent in it, for flamegraph tools
+	bool write_collapsed( const std::string &path ) const;
+
+	// PRG banks are reported in the 8KB units the finest supported mappers switch
+	static constexpr int BANK_SIZE = 0x2000;
+
+private:
+	// Code in ROM is counted by ROM offset, after the 64KB of CPU addresses used for code running from RAM
+	static constexpr u32 ROM_KEYS = 0x10000;
+
+	static std::string label( u16 pc, long rom );
+
+	struct Frame
+	{
+		u32 parent;
+		FrameKind kind;
+		u16 pc;
+		long rom;
+		u64 cycles;
+		std::unordered_map< u64, u32 > children;
+	};
+
+	std::vector< u64 > key_cycles;
+	std::vector< u64 > key_count;
+	// The address and opcode each was last seen at; code in RAM may have changed since
+	std::vector< u16 > key_pc;
+	std::vector< u8 > key_opcode;
+	std::array< u64, 256 > opcode_cycles{};
+	std::array< u64, 256 > opcode_count{};
+	u64 interrupt_cycles = 0;
+	u64 dma_cycles = 0;
+	u64 total_cycles = 0;
+
+	// frames[0] is the root, for code not called from anywhere the profile has seen. Frames form a tree of every
+	// call path seen; the stack holds the path running now, with the stack pointer each call left behind
+	std::vector< Frame > frames;
+
+	struct Activation
+	{
+		u32 frame;
+		int s;
+	};
+	std::vector< Activation > stack;
+};
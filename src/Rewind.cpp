@@ -0,0 +1,257 @@
+#include "Rewind.h"
+#include "NES.h"
+
+#include <chrono>
+#include <cstring>
+
+// Unchanged stretches shorter than this are cheaper to copy along with the changed bytes around them
+static constexpr size_t MIN_SKIP = 4;
+
+static const std::vector< u8 > NO_BASE;
+
+static u8 *put_varint( u8 *out, size_t value )
+{
+	while ( value >= 0x80 )
+	{
+		*out++ = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	*out++ = value;
+	return out;
+}
+
+static size_t get_varint( const u8 *&in )
+{
+	size_t value = 0;
+	int shift = 0;
+	u8 byte;
+	do
+	{
+		byte = *in++;
+		value |= (size_t)(byte & 0x7F) << shift;
+		shift += 7;
+	}
+	while ( byte & 0x80 );
+	return value;
+}
+
+Rewind::Rewind( size_t capacity ) : arena( capacity )
+{
+}
+
+void Rewind::push( NES *nes )
+{
+	auto start = std::chrono::steady_clock::now();
+	nes->save_state( state );
+
+	// Bytes past the end of a shorter base count as zero
+	if ( zeros.size() < state.size() )
+	{
+		zeros.resize( state.size() );
+	}
+	if ( key_state.size() < state.size() )
+	{
+		key_state.resize( state.size() );
+	}
+
+	bool keyframe = snapshots.empty() || since_key + 1 >= KEYFRAME_INTERVAL;
+	size_t size = encode( state, keyframe ? zeros.data() : key_state.data(), encoded );
+	size_t offset = allocate( size );
+	if ( !keyframe && snapshots.empty() )
+	{
+		// The arena couldn't hold on to the keyframe this delta was taken against
+		keyframe = true;
+		size = encode( state, zeros.data(), encoded );
+		offset = allocate( size );
+	}
+	if ( offset == SIZE_MAX )
+	{
+		clear();
+		return;
+	}
+
+	memcpy( arena.data() + offset, encoded.data(), size );
+	snapshots.push_back( { offset, (u32)size, (u32)state.size(), keyframe } );
+	bytes_used += size;
+	head = offset + size;
+	if ( keyframe )
+	{
+		key_state.swap( state );
+		since_key = 0;
+	}
+	else
+	{
+		++since_key;
+	}
+
+	push_us_total += std::chrono::duration<double, std::micro>( std::chrono::steady_clock::now() - start ).count();
+	++pushes;
+}
+
+bool Rewind::step_back( NES *nes )
+{
+	if ( snapshots.empty() )
+	{
+		return false;
+	}
+
+	Snapshot snap = snapshots.back();
+	decode( arena.data() + snap.offset, snap.size, snap.keyframe ? NO_BASE : key_state, snap.state_size, state );
+	snapshots.pop_back();
+	bytes_used -= snap.size;
+	head = snap.offset;
+
+	if ( snap.keyframe )
+	{
+		// The deltas now at the back were taken against the keyframe before this one
+		since_key = 0;
+		auto it = snapshots.rbegin();
+		for ( ; it != snapshots.rend() && !it->keyframe; ++it )
+		{
+			++since_key;
+		}
+		if ( it != snapshots.rend() )
+		{
+			decode( arena.data() + it->offset, it->size, NO_BASE, it->state_size, key_state );
+		}
+	}
+	else
+	{
+		--since_key;
+	}
+
+	return nes->load_state( state.data(), state.size() );
+}
+
+void Rewind::clear()
+{
+	snapshots.clear();
+	head = 0;
+	bytes_used = 0;
+	since_key = 0;
+}
+
+size_t Rewind::encode( const std::vector< u8 > &state, const u8 *base, std::vector< u8 > &out )
+{
+	size_t size = state.size();
+	// Every run but the first skips at least MIN_SKIP bytes, which bounds the overhead of the two lengths
+	size_t bound = size + (size / MIN_SKIP + 1) * 2 * 5;
+	if ( out.size() < bound )
+	{
+		out.resize( bound );
+	}
+
+	const u8 *in = state.data();
+	u8 *w = out.data();
+	size_t i = 0;
+	while ( i < size )
+	{
+		// Most of a delta is unchanged, so skip over it a word at a time
+		size_t skip_start = i;
+		for ( ; i + 8 <= size; i += 8 )
+		{
+			u64 a, b;
+			memcpy( &a, in + i, 8 );
+			memcpy( &b, base + i, 8 );
+			if ( a != b )
+			{
+				break;
+			}
+		}
+		while ( i < size && in[i] == base[i] )
+		{
+			i++;
+		}
+		if ( i == size )
+		{
+			break;
+		}
+
+		size_t run_start = i;
+		while ( i < size )
+		{
+			if ( in[i] != base[i] )
+			{
+				i++;
+				continue;
+			}
+			size_t same = 0;
+			while ( same < MIN_SKIP && i + same < size && in[i + same] == base[i + same] )
+			{
+				same++;
+			}
+			if ( same == MIN_SKIP || i + same == size )
+			{
+				break;
+			}
+			i += same;
+		}
+
+		w = put_varint( w, run_start - skip_start );
+		w = put_varint( w, i - run_start );
+		for ( size_t j = run_start; j < i; j++ )
+		{
+			*w++ = in[j] ^ base[j];
+		}
+	}
+
+	return w - out.data();
+}
+
+void Rewind::decode( const u8 *in, u32 size, const std::vector< u8 > &base, u32 state_size, std::vector< u8 > &out )
+{
+	out.assign( base.begin(), base.begin() + std::min( base.size(), (size_t)state_size ) );
+	out.resize( state_size, 0 );
+
+	const u8 *end = in + size;
+	size_t pos = 0;
+	while ( in < end )
+	{
+		pos += get_varint( in );
+		size_t len = get_varint( in );
+		for ( size_t j = 0; j < len; j++ )
+		{
+			out[pos + j] ^= in[j];
+		}
+		in += len;
+		pos += len;
+	}
+}
+
+size_t Rewind::allocate( u32 size )
+{
+	if ( size > arena.size() )
+	{
+		return SIZE_MAX;
+	}
+
+	size_t offset = head;
+	if ( offset + size > arena.size() )
+	{
+		// Wrap around; everything past the old head is older than anything before it
+		while ( !snapshots.empty() && snapshots.front().offset >= head )
+		{
+			pop_front();
+		}
+		offset = 0;
+	}
+
+	while ( !snapshots.empty() && snapshots.front().offset < offset + size
+	        && snapshots.front().offset + snapshots.front().size > offset )
+	{
+		pop_front();
+	}
+	// Deltas are useless without the keyframe before them
+	while ( !snapshots.empty() && !snapshots.front().keyframe )
+	{
+		pop_front();
+	}
+
+	return offset;
+}
+
+void Rewind::pop_front()
+{
+	bytes_used -= snapshots.front().size;
+	snapshots.pop_front();
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include "BitUtils.h"
+
+class NES;
+
+// Rewind history: a save state per frame, kept in a fixed-size ring arena. Every KEYFRAME_INTERVAL frames the
+// full state is stored, and the frames in between only keep the run-length encoded XOR against that keyframe,
+// which is mostly zeros as RAM and VRAM change little from frame to frame
+class Rewind
+{
+public:
+	static constexpr int KEYFRAME_INTERVAL = 60;
+
+	explicit Rewind( size_t capacity = 6 << 20 );
+
+	// Records the machine as it is now, dropping the oldest frames once the arena is full
+	void push( NES *nes );
+
+	// Restores the most recent snapshot and forgets it; false once the history has run out
+	bool step_back( NES *nes );
+
+	void clear();
+
+	size_t get_frames() const
+	{
+		return snapshots.size();
+	}
+
+	size_t get_bytes_used() const
+	{
+		return bytes_used;
+	}
+
+	size_t get_capacity() const
+	{
+		return arena.size();
+	}
+
+	// Average time push() took to capture and encode a frame
+	double get_push_us() const
+	{
+		return pushes == 0 ? 0 : push_us_total / pushes;
+	}
+
+private:
+	struct Snapshot
+	{
+		size_t offset;
+		u32 size;
+		u32 state_size;
+		bool keyframe;
+	};
+
+	// Writes the XOR of state against base as runs of (unchanged bytes, changed bytes, the changed bytes XORed)
+	// and returns the encoded size. base must be at least as long as state; an all-zero base keeps the state
+	// as is
+	static size_t encode( const std::vector< u8 > &state, const u8 *base, std::vector< u8 > &out );
+
+	static void decode( const u8 *in, u32 size, const std::vector< u8 > &base, u32 state_size, std::vector< u8 > &out );
+
+	// Makes room for size contiguous bytes, evicting the oldest snapshots in the way
+	size_t allocate( u32 size );
+
+	void pop_front();
+
+	std::vector< u8 > arena;
+	size_t head = 0;
+	size_t bytes_used = 0;
+	std::deque< Snapshot > snapshots;
+
+	// The newest keyframe, decoded, which the deltas after it are taken against
+	std::vector< u8 > key_state;
+	int since_key = 0;
+
+	std::vector< u8 > state;
+	std::vector< u8 > encoded;
+	std::vector< u8 > zeros;
+
+	long pushes = 0;
+	double push_us_total = 0;
+};
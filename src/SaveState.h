@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstring>
+#include <deque>
+#include <type_traits>
+#include <vector>
+#include "BitUtils.h"
+#include "Memory.h"
+
+// Binary machine state. Each component describes its state once in serialize(), and the same io() calls either
+// append to a buffer or read back from one, so saving and loading can't drift apart
+class SaveState
+{
+public:
+	static constexpr u32 MAGIC = 0x5453504E; // "NPST"
+	// Bump whenever any serialize() changes what it reads or writes
+	static constexpr u32 VERSION = 3;
+
+	// Starts a new state in out, reusing its capacity
+	static SaveState writer( std::vector< u8 > &out )
+	{
+		out.clear();
+		return SaveState( &out, nullptr, 0 );
+	}
+
+	static SaveState reader( const u8 *in, size_t size )
+	{
+		return SaveState( nullptr, in, size );
+	}
+
+	bool is_loading() const
+	{
+		return out == nullptr;
+	}
+
+	// False once a read ran past the end of the state or a memory block didn't match in size
+	bool ok() const
+	{
+		return !failed;
+	}
+
+	bool at_end() const
+	{
+		return pos == in_size;
+	}
+
+	template < typename T >
+	void io( T &value )
+	{
+		static_assert( std::is_trivially_copyable_v< T >, "only plain data can be copied into a save state" );
+		io_bytes( &value, sizeof( T ) );
+	}
+
+	void io( Memory &mem )
+	{
+		u32 size = mem.get_size();
+		io( size );
+		if ( size != mem.get_size() )
+		{
+			failed = true;
+			return;
+		}
+		if ( size > 0 )
+		{
+			io_bytes( mem.get_mem(), size );
+		}
+	}
+
+	template < typename T >
+	void io( std::vector< T > &values )
+	{
+		io_container( values );
+	}
+
+	template < typename T >
+	void io( std::deque< T > &values )
+	{
+		io_container( values );
+	}
+
+	void io_bytes( void *data, size_t size )
+	{
+		if ( out != nullptr )
+		{
+			size_t at = out->size();
+			out->resize( at + size );
+			memcpy( out->data() + at, data, size );
+		}
+		else if ( !failed && pos + size <= in_size )
+		{
+			memcpy( data, in + pos, size );
+			pos += size;
+		}
+		else
+		{
+			failed = true;
+		}
+	}
+
+private:
+	SaveState( std::vector< u8 > *out, const u8 *in, size_t in_size ) : out( out ), in( in ), in_size( in_size )
+	{
+	}
+
+	template < typename C >
+	void io_container( C &values )
+	{
+		u32 size = values.size();
+		io( size );
+		if ( is_loading() )
+		{
+			if ( failed || size > in_size - pos )
+			{
+				failed = true;
+				return;
+			}
+			values.resize( size );
+		}
+		for ( auto &value : values )
+		{
+			io( value );
+		}
+	}
+
+	std::vector< u8 > *out;
+	const u8 *in;
+	size_t in_size;
+	size_t pos = 0;
+	bool failed = false;
+};
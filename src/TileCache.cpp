@@ -0,0 +1,23 @@
+#include "TileCache.h"
+
+#include <algorithm>
+
+void TileCache::init( const u8 *chr_mem, size_t chr_size )
+{
+	chr = chr_mem;
+	size = chr_size;
+	// At least a whole page, for the odd cartridge with less than 1KB of CHR RAM
+	rows.assign( row_index( std::max( size, (size_t)0x400 ) - 1 ) + 1, 0 );
+	rebuild();
+}
+
+void TileCache::rebuild()
+{
+	for ( size_t tile = 0; tile + 16 <= size; tile += 16 )
+	{
+		for ( int y = 0; y < 8; y++ )
+		{
+			rows[row_index( tile + y )] = decode( chr[tile + y], chr[tile + y + 8] );
+		}
+	}
+}
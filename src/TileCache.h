@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include "BitUtils.h"
+
+// Every pattern row of CHR memory, pre-decoded from its two bit planes into 8 2-bit color indices with the
+// leftmost pixel in the top bits. Rows are indexed by CHR offset, so a PPU page maps to its rows as directly as
+// to its bytes; CHR RAM rows are redecoded as they are written
+class TileCache
+{
+public:
+	// Decodes all of chr, which the cache keeps pointing into
+	void init( const u8 *chr, size_t size );
+
+	// Decodes everything again, after CHR RAM has been replaced wholesale by a state load
+	void rebuild();
+
+	// After a write to the CHR byte at mem
+	void update( const u8 *mem )
+	{
+		size_t offset = mem - chr;
+		if ( offset < size )
+		{
+			size_t lo = offset & ~(size_t)8;
+			rows[row_index( lo )] = decode( chr[lo], chr[lo | 8] );
+		}
+	}
+
+	// Rows of the 1KB CHR page at mem, indexed as by row_index() within the page. Banks past the end of CHR
+	// memory wrap around
+	const u16 *page( const u8 *mem ) const
+	{
+		return size == 0 ? rows.data() : rows.data() + row_index( (size_t)(mem - chr) % size );
+	}
+
+	// The row holding the low plane byte at a CHR offset; the high plane is 8 bytes after it
+	static size_t row_index( size_t offset )
+	{
+		return (offset >> 1 & ~(size_t)7) | (offset & 7);
+	}
+
+	static u16 decode( u8 lo, u8 hi )
+	{
+		return spread( lo ) | spread( hi ) << 1;
+	}
+
+private:
+	// Moves bit n to bit 2n
+	static u16 spread( u8 bits )
+	{
+		u16 x = bits;
+		x = (x | x << 4) & 0x0F0F;
+		x = (x | x << 2) & 0x3333;
+		x = (x | x << 1) & 0x5555;
+		return x;
+	}
+
+	const u8 *chr = nullptr;
+	size_t size = 0;
+	std::vector< u16 > rows;
+};
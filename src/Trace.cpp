@@ -0,0 +1,56 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+
+Trace::Trace( size_t capacity ) : capacity( std::bit_ceil( capacity ) )
+{
+}
+
+void Trace::set_enabled( bool enable )
+{
+	if ( enable && ring.empty() )
+	{
+		ring.resize( capacity );
+	}
+	enabled = enable;
+}
+
+void Trace::clear()
+{
+	head = 0;
+	count = 0;
+}
+
+bool Trace::dump( const std::string &path ) const
+{
+	std::ofstream file( path, std::ios::binary );
+	FileHeader header{};
+	std::memcpy( header.magic, MAGIC, sizeof( header.magic ) );
+	header.version = VERSION;
+	header.record_size = sizeof( Record );
+	header.records = count;
+	file.write( (const char *)&header, sizeof( header ) );
+
+	// Once the ring has wrapped, the oldest record is the one head is about to overwrite
+	size_t first = count < ring.size() ? 0 : head;
+	size_t tail = std::min( count, ring.size() - first );
+	file.write( (const char *)(ring.data() + first), tail * sizeof( Record ) );
+	file.write( (const char *)ring.data(), (count - tail) * sizeof( Record ) );
+	return file.good();
+}
+
+bool Trace::load( const std::string &path, std::vector< Record > &out )
+{
+	std::ifstream file( path, std::ios::binary );
+	FileHeader header{};
+	if ( !file.read( (char *)&header, sizeof( header ) ) || std::memcmp( header.magic, MAGIC, sizeof( header.magic ) ) != 0
+	     || header.version != VERSION || header.record_size != sizeof( Record ) )
+	{
+		return false;
+	}
+	out.resize( header.records );
+	return (bool)file.read( (char *)out.data(), header.records * sizeof( Record ) );
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "BitUtils.h"
+
+// Execution trace: a fixed-size ring of fixed-layout binary records, one per instruction and one per CPU bus
+// access, that keeps the most recent ones once it fills up. Nothing is recorded unless it is enabled, and the
+// ring can be dumped to a file at any point for the offline trace tool to render and compare
+class Trace
+{
+public:
+	enum Kind : u8
+	{
+		INSTRUCTION, READ, WRITE
+	};
+
+	// Instruction records hold the registers and PPU position before the opcode fetch; bus records only fill in
+	// the cycle, the address (in pc) and the byte that went over the bus (in opcode)
+	struct Record
+	{
+		u64 cycle;
+		u16 pc;
+		// -1 on the pre-render line
+		i16 scanline;
+		u16 dot;
+		u8 kind;
+		u8 opcode;
+		u8 operands[2];
+		u8 a, x, y, p, s;
+		u8 unused;
+	};
+	static_assert( sizeof( Record ) == 24 );
+
+	// Dump files are this header followed by the records, oldest first, in the host's byte order
+	struct FileHeader
+	{
+		char magic[8];
+		u32 version;
+		u32 record_size;
+		u64 records;
+	};
+
+	static constexpr char MAGIC[8] = "NESPTRC";
+	static constexpr u32 VERSION = 1;
+
+	// Capacity in records, rounded up to a power of two. The ring itself is only allocated once enabled
+	explicit Trace( size_t capacity = 1 << 18 );
+
+	void set_enabled( bool enabled );
+
+	bool is_enabled() const
+	{
+		return enabled;
+	}
+
+	void record( const Record &rec )
+	{
+		ring[head] = rec;
+		head = (head + 1) & (ring.size() - 1);
+		if ( count < ring.size() )
+		{
+			++count;
+		}
+	}
+
+	void record_bus( Kind kind, u16 addr, u8 data, long cycle )
+	{
+		Record rec{};
+		rec.cycle = cycle;
+		rec.pc = addr;
+		rec.kind = kind;
+		rec.opcode = data;
+		record( rec );
+	}
+
+	void clear();
+
+	size_t get_records() const
+	{
+		return count;
+	}
+
+	size_t get_capacity() const
+	{
+		return capacity;
+	}
+
+	bool dump( const std::string &path ) const;
+
+	// Reads back a file written by dump(); false if it isn't one
+	static bool load( const std::string &path, std::vector< Record > &out );
+
+private:
+	size_t capacity;
+	bool enabled = false;
+	std::vector< Record > ring;
+	size_t head = 0;
+	size_t count = 0;
+};
@@ -133,6 +133,26 @@ void UI::handle_global( SDL_Event &e )
 			}
 		}
 	}
+	else if ( e.key.keysym.scancode == SDL_SCANCODE_F5 && state != UIState::MAIN )
+	{
+		nes->save_state_file( "NESP_Saves/" + nes->filename + ".state" );
+	}
+	else if ( e.key.keysym.scancode == SDL_SCANCODE_F7 && state != UIState::MAIN )
+	{
+		nes->load_state_file( "NESP_Saves/" + nes->filename + ".state" );
+	}
+	else if ( e.key.keysym.scancode == SDL_SCANCODE_F8 && state != UIState::MAIN )
+	{
+		nes->set_cdl_logging( !nes->is_cdl_logging() );
+	}
+	else if ( e.key.keysym.scancode == SDL_SCANCODE_F9 && state != UIState::MAIN )
+	{
+		nes->set_tracing( !nes->get_trace()->is_enabled() );
+	}
+	else if ( e.key.keysym.scancode == SDL_SCANCODE_F10 && state != UIState::MAIN )
+	{
+		nes->get_trace()->dump( "NESP_Saves/" + nes->filename + ".trace" );
+	}
 	else if ( SDL_GetModState() & KMOD_CTRL )
 	{
 		switch ( e.key.keysym.scancode )
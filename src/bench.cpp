@@ -0,0 +1,196 @@
+#include "NES.h"
+#include "CPU.h"
+#include "PPU.h"
+#include "Cartridge.h"
+#include "Compositor.h"
+#include "APU/APU.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Runs each ROM through the real headless core and prints throughput as a JSON array, for tracking regressions
+static bool bench_rom( const char *rom, long frames, long instructions, bool dot_renderer, int render_interval,
+                       bool rewind, bool first )
+{
+	// Keep stdout clean for the JSON report; the cartridge loader logs its header there
+	std::streambuf *stdout_buf = std::cout.rdbuf( std::cerr.rdbuf() );
+	NES *nes = new NES();
+	bool loaded = nes->run( rom );
+	std::cout.rdbuf( stdout_buf );
+	if ( !loaded )
+	{
+		std::cerr << rom << ": " << nes->get_cart()->get_error() << std::endl;
+		delete nes;
+		return false;
+	}
+
+	CPU *cpu = nes->get_cpu();
+	PPU *ppu = nes->get_ppu();
+	APU *apu = nes->get_apu();
+	ppu->set_line_renderer( !dot_renderer );
+	ppu->set_render_interval( render_interval );
+	long start_instructions = cpu->get_instructions();
+	long start_frames = ppu->get_frame();
+	long start_dots = ppu->get_dots();
+	long start_samples = apu->get_samples_queued();
+	long start_drawn = nes->get_frame_buffer()->get_frames_pushed();
+
+	auto start = std::chrono::steady_clock::now();
+	if ( instructions > 0 )
+	{
+		nes->run_instructions( instructions );
+	}
+	else if ( rewind )
+	{
+		// Record a rewind snapshot every frame, as the windowed build does
+		for ( long f = 0; f < frames; f++ )
+		{
+			nes->get_rewind()->push( nes );
+			nes->run_frames( 1 );
+		}
+	}
+	else
+	{
+		nes->run_frames( frames );
+	}
+	double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	long ran_instructions = cpu->get_instructions() - start_instructions;
+	long ran_frames = ppu->get_frame() - start_frames;
+	long ran_dots = ppu->get_dots() - start_dots;
+	long ran_samples = apu->get_samples_queued() - start_samples;
+	long ran_drawn = nes->get_frame_buffer()->get_frames_pushed() - start_drawn;
+
+	// Time snapshots of the machine as it stands after the run
+	constexpr int STATE_REPS = 100;
+	std::vector< u8 > state;
+	std::vector< u8 > scratch;
+	nes->save_state( state );
+	auto state_start = std::chrono::steady_clock::now();
+	for ( int i = 0; i < STATE_REPS; i++ )
+	{
+		nes->save_state( scratch );
+	}
+	auto state_mid = std::chrono::steady_clock::now();
+	for ( int i = 0; i < STATE_REPS; i++ )
+	{
+		nes->load_state( state.data(), state.size() );
+	}
+	auto state_end = std::chrono::steady_clock::now();
+	double save_us = std::chrono::duration<double, std::micro>( state_mid - state_start ).count() / STATE_REPS;
+	double load_us = std::chrono::duration<double, std::micro>( state_end - state_mid ).count() / STATE_REPS;
+
+	// Time the PPU on its own for a few frames from there, without the CPU and APU, then put the machine back
+	constexpr long PPU_DOTS = 341L * 262 * 20;
+	u64 frame_hash = nes->get_frame_buffer()->hash();
+	auto ppu_start = std::chrono::steady_clock::now();
+	for ( long i = 0; i < PPU_DOTS; i++ )
+	{
+		ppu->run();
+	}
+	double ppu_seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - ppu_start ).count();
+	nes->load_state( state.data(), state.size() );
+
+	std::cout << (first ? "" : ",\n")
+	          << "  {\n"
+	          << "    \"rom\": \"" << nes->filename << "\",\n"
+	          << "    \"mode\": \"" << (instructions > 0 ? "instructions" : "frames") << "\",\n"
+	          << "    \"renderer\": \"" << (dot_renderer ? "dot" : "line") << "\",\n"
+	          << "    \"compose\": \"" << Compositor::name( Compositor::get_isa() ) << "\",\n"
+	          << "    \"render_every\": " << render_interval << ",\n"
+	          << "    \"seconds\": " << seconds << ",\n"
+	          << "    \"instructions\": " << ran_instructions << ",\n"
+	          << "    \"frames\": " << ran_frames << ",\n"
+	          << "    \"frames_drawn\": " << ran_drawn << ",\n"
+	          << "    \"ppu_dots\": " << ran_dots << ",\n"
+	          << "    \"apu_samples\": " << ran_samples << ",\n"
+	          << "    \"instructions_per_sec\": " << (long)(ran_instructions / seconds) << ",\n"
+	          << "    \"frames_per_sec\": " << ran_frames / seconds << ",\n"
+	          << "    \"ppu_dots_per_sec\": " << (long)(ran_dots / seconds) << ",\n"
+	          << "    \"ppu_only_dots_per_sec\": " << (long)(PPU_DOTS / ppu_seconds) << ",\n"
+	          << "    \"apu_samples_per_sec\": " << (long)(ran_samples / seconds) << ",\n"
+	          << "    \"state_bytes\": " << state.size() << ",\n"
+	          << "    \"rewind_frames\": " << nes->get_rewind()->get_frames() << ",\n"
+	          << "    \"rewind_bytes\": " << nes->get_rewind()->get_bytes_used() << ",\n"
+	          << "    \"rewind_push_us\": " << nes->get_rewind()->get_push_us() << ",\n"
+	          << "    \"save_state_us\": " << save_us << ",\n"
+	          << "    \"load_state_us\": " << load_us << ",\n"
+	          << "    \"cpu_cycles\": " << cpu->get_cycle() << ",\n"
+	          << "    \"idle_cycles_skipped\": " << cpu->get_skipped_cycles() << ",\n"
+	          << "    \"frame_hash\": \"" << std::hex << frame_hash << std::dec << "\"\n"
+	          << "  }";
+
+	delete nes;
+	return true;
+}
+
+int main( int argc, char *argv[] )
+{
+	long frames = 600;
+	long instructions = 0;
+	bool dot_renderer = false;
+	int render_interval = 1;
+	bool rewind = false;
+	std::vector<const char *> roms;
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( strcmp( argv[i], "--frames" ) == 0 && i + 1 < argc )
+		{
+			frames = std::stol( argv[++i] );
+		}
+		else if ( strcmp( argv[i], "--minstr" ) == 0 && i + 1 < argc )
+		{
+			instructions = std::stol( argv[++i] ) * 1000000;
+		}
+		else if ( strcmp( argv[i], "--dot-renderer" ) == 0 )
+		{
+			dot_renderer = true;
+		}
+		else if ( strcmp( argv[i], "--render-every" ) == 0 && i + 1 < argc )
+		{
+			// Frame skip: draw one frame in N, or none for 0
+			render_interval = std::stoi( argv[++i] );
+		}
+		else if ( strcmp( argv[i], "--rewind" ) == 0 )
+		{
+			rewind = true;
+		}
+		else if ( strcmp( argv[i], "--compose" ) == 0 && i + 1 < argc )
+		{
+			// Narrower than the host supports, to compare against; the widest is picked by default
+			std::string isa = argv[++i];
+			Compositor::select( isa == "scalar" ? Compositor::SCALAR : isa == "sse4.1" ? Compositor::SSE41 : Compositor::AVX2 );
+		}
+		else
+		{
+			roms.push_back( argv[i] );
+		}
+	}
+
+	if ( roms.empty() )
+	{
+		std::cerr << "Usage: " << argv[0] << " <rom>... [--frames N | --minstr N] [--dot-renderer] [--render-every N] [--rewind] [--compose scalar|sse4.1|avx2]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	bool ok = true;
+	bool first = true;
+	std::cout << "[\n";
+	for ( const char *rom : roms )
+	{
+		if ( bench_rom( rom, frames, instructions, dot_renderer, render_interval, rewind, first ) )
+		{
+			first = false;
+		}
+		else
+		{
+			ok = false;
+		}
+	}
+	std::cout << "\n]" << std::endl;
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,12 +1,133 @@
 #include "NES.h"
 
 #include <iostream>
+#ifdef NESPRIME_HEADLESS
+#include <cstring>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "CPU.h"
+#include "PPU.h"
+#include "Cartridge.h"
+#include "APU/APU.h"
+#else
 #include "SDL.h"
+#endif
 
+#ifdef NESPRIME_HEADLESS
+int main(int argc, char *argv[]) {
+    // --trace <file> records the run and dumps the most recent records there at the end; --profile <prefix>
+    // writes <prefix>.txt and <prefix>.folded in builds with the profiler; --cdl adds to NESP_Saves/<rom>.cdl;
+    // --render-every <n> draws one frame in n, or none for 0
+    const char *trace_path = nullptr;
+    const char *profile_prefix = nullptr;
+    bool cdl = false;
+    int render_interval = 1;
+    std::vector<const char *> args;
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( strcmp( argv[i], "--trace" ) == 0 && i + 1 < argc )
+        {
+            trace_path = argv[++i];
+        }
+        else if ( strcmp( argv[i], "--profile" ) == 0 && i + 1 < argc )
+        {
+            profile_prefix = argv[++i];
+        }
+        else if ( strcmp( argv[i], "--cdl" ) == 0 )
+        {
+            cdl = true;
+        }
+        else if ( strcmp( argv[i], "--render-every" ) == 0 && i + 1 < argc )
+        {
+            render_interval = std::stoi( argv[++i] );
+        }
+        else
+        {
+            args.push_back( argv[i] );
+        }
+    }
+
+    if ( args.empty() )
+    {
+        std::cerr << "Usage: " << argv[0] << " <rom> [frames] [--trace <file>] [--profile <prefix>] [--cdl] [--render-every <n>]" << std::endl;
+        return EXIT_FAILURE;
+    }
+#ifndef NESPRIME_PROFILER
+    if ( profile_prefix != nullptr )
+    {
+        std::cerr << "This build has no profiler; configure with -DNESPRIME_PROFILER=ON" << std::endl;
+        return EXIT_FAILURE;
+    }
+#endif
+
+    NES* nes = new NES();
+
+    if ( !nes->run( args[0] ) )
+    {
+        std::cerr << nes->get_cart()->get_error() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if ( trace_path != nullptr )
+    {
+        nes->set_tracing( true );
+    }
+    if ( cdl )
+    {
+        nes->set_cdl_logging( true );
+    }
+    nes->get_ppu()->set_render_interval( render_interval );
+
+    auto start = std::chrono::steady_clock::now();
+    if ( args.size() > 1 )
+    {
+        nes->run_frames( std::stol( args[1] ) );
+    }
+    else
+    {
+        nes->run();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if ( trace_path != nullptr && !nes->get_trace()->dump( trace_path ) )
+    {
+        std::cerr << "Couldn't write the trace to " << trace_path << std::endl;
+    }
+#ifdef NESPRIME_PROFILER
+    if ( profile_prefix != nullptr )
+    {
+        nes->get_cpu()->get_profiler()->write_flat( std::string( profile_prefix ) + ".txt" );
+        nes->get_cpu()->get_profiler()->write_collapsed( std::string( profile_prefix ) + ".folded" );
+    }
+#endif
+
+    long instructions = nes->get_cpu()->get_instructions();
+    std::cout << "frames: " << nes->get_frame_buffer()->get_frames_pushed() << "\n";
+    std::cout << "cpu cycles: " << nes->get_cpu()->get_cycle() << "\n";
+    std::cout << "cpu instructions: " << instructions << "\n";
+    std::cout << "instructions/sec: " << (long)(instructions / elapsed.count()) << "\n";
+    std::cout << "audio samples: " << nes->get_apu()->get_samples_queued() << "\n";
+    std::cout << "frame hash: " << std::hex << std::setw( 16 ) << std::setfill( '0' )
+              << nes->get_frame_buffer()->hash() << std::endl;
+    if ( cdl )
+    {
+        CodeDataLog *log = nes->get_cart()->get_cdl();
+        std::cout << std::dec << "cdl: " << log->count( CodeDataLog::CODE ) << " code, "
+                  << log->count( CodeDataLog::DATA ) << " data, " << log->count( CodeDataLog::DMC ) << " DMC, "
+                  << log->count( CodeDataLog::RENDERED ) << " rendered, " << log->count( CodeDataLog::READ )
+                  << " read" << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
+#else
 int main(int argc, char *argv[]) {
     NES* nes = new NES();
 
     nes->run();
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+#endif
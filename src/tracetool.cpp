@@ -0,0 +1,310 @@
+#include "CPU.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Renders a trace dumped by the emulator as nestest-style log lines, or compares it against a reference log
+// such as nestest.log. Memory annotations ("= 00") can't be recovered from the trace, so they are left out of
+// the rendering and ignored when comparing
+
+static std::string disassemble( const Trace::Record &rec )
+{
+	const opcode_info &info = CPU::get_opcode_info( rec.opcode );
+	if ( info.op_func == nullptr )
+	{
+		return " ???";
+	}
+
+	u8 lo = rec.operands[0];
+	u16 abs = lo | rec.operands[1] << 8;
+	char operand[16] = "";
+	switch ( info.mode )
+	{
+		case Accumulator:
+			snprintf( operand, sizeof( operand ), "A" );
+			break;
+		case Immediate:
+			snprintf( operand, sizeof( operand ), "#$%02X", lo );
+			break;
+		case ZeroPage:
+			snprintf( operand, sizeof( operand ), "$%02X", lo );
+			break;
+		case IndexedZeroX:
+			snprintf( operand, sizeof( operand ), "$%02X,X", lo );
+			break;
+		case IndexedZeroY:
+			snprintf( operand, sizeof( operand ), "$%02X,Y", lo );
+			break;
+		case Absolute:
+			snprintf( operand, sizeof( operand ), "$%04X", abs );
+			break;
+		case IndexedAbsoluteX:
+			snprintf( operand, sizeof( operand ), "$%04X,X", abs );
+			break;
+		case IndexedAbsoluteY:
+			snprintf( operand, sizeof( operand ), "$%04X,Y", abs );
+			break;
+		case Indirect:
+			snprintf( operand, sizeof( operand ), "($%04X)", abs );
+			break;
+		case IndexedIndirectX:
+			snprintf( operand, sizeof( operand ), "($%02X,X)", lo );
+			break;
+		case IndexedIndirectY:
+			snprintf( operand, sizeof( operand ), "($%02X),Y", lo );
+			break;
+		case Relative:
+			snprintf( operand, sizeof( operand ), "$%04X", (u16)(rec.pc + 2 + (i8)lo) );
+			break;
+		default:
+			break;
+	}
+
+	// Unofficial opcodes are marked with a * in the column before the mnemonic
+	const char *name = OP_NAMES[info.id];
+	std::string text = name[0] == '*' ? name : std::string( " " ) + name;
+	if ( operand[0] )
+	{
+		text += std::string( " " ) + operand;
+	}
+	return text;
+}
+
+static std::string render( const Trace::Record &rec )
+{
+	char line[128];
+	if ( rec.kind != Trace::INSTRUCTION )
+	{
+		snprintf( line, sizeof( line ), "      %s $%04X = %02X  CYC:%llu", rec.kind == Trace::READ ? "READ " : "WRITE",
+		          rec.pc, rec.opcode, (unsigned long long)rec.cycle );
+		return line;
+	}
+
+	int size = CPU::instruction_size( CPU::get_opcode_info( rec.opcode ).mode );
+	char bytes[16];
+	if ( size == 1 )
+	{
+		snprintf( bytes, sizeof( bytes ), "%02X", rec.opcode );
+	}
+	else if ( size == 2 )
+	{
+		snprintf( bytes, sizeof( bytes ), "%02X %02X", rec.opcode, rec.operands[0] );
+	}
+	else
+	{
+		snprintf( bytes, sizeof( bytes ), "%02X %02X %02X", rec.opcode, rec.operands[0], rec.operands[1] );
+	}
+	snprintf( line, sizeof( line ), "%04X  %-9s%-33sA:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%llu", rec.pc,
+	          bytes, disassemble( rec ).c_str(), rec.a, rec.x, rec.y, rec.p, rec.s, rec.scanline, rec.dot,
+	          (unsigned long long)rec.cycle );
+	return line;
+}
+
+// The fields of a log line that a trace can reproduce
+struct LogLine
+{
+	int pc = -1;
+	std::string bytes;
+	int a = -1, x = -1, y = -1, p = -1, s = -1;
+	bool has_ppu = false;
+	int scanline = 0, dot = 0;
+	long long cycle = -1;
+};
+
+static int hex_field( const std::string &line, const char *key )
+{
+	size_t at = line.find( key );
+	return at == std::string::npos ? -1 : std::stoi( line.substr( at + strlen( key ), 2 ), nullptr, 16 );
+}
+
+static LogLine parse( const std::string &line )
+{
+	LogLine parsed;
+	if ( line.size() < 16 )
+	{
+		return parsed;
+	}
+	parsed.pc = std::stoi( line.substr( 0, 4 ), nullptr, 16 );
+	parsed.bytes = line.substr( 6, 8 );
+	parsed.bytes.erase( parsed.bytes.find_last_not_of( ' ' ) + 1 );
+	parsed.a = hex_field( line, "A:" );
+	parsed.x = hex_field( line, "X:" );
+	parsed.y = hex_field( line, "Y:" );
+	parsed.p = hex_field( line, "P:" );
+	parsed.s = hex_field( line, "SP:" );
+	size_t ppu = line.find( "PPU:" );
+	if ( ppu != std::string::npos )
+	{
+		parsed.has_ppu = sscanf( line.c_str() + ppu + 4, "%d,%d", &parsed.scanline, &parsed.dot ) == 2;
+		// Some logs number the pre-render line 261 rather than -1
+		if ( parsed.scanline == 261 )
+		{
+			parsed.scanline = -1;
+		}
+	}
+	size_t cyc = line.find( "CYC:" );
+	if ( cyc != std::string::npos )
+	{
+		parsed.cycle = std::stoll( line.substr( cyc + 4 ) );
+	}
+	return parsed;
+}
+
+// Names the first field that differs, or returns null. Cycle counts are compared from where each log starts,
+// as the reference may count the reset sequence differently
+static const char *compare( const LogLine &ref, const LogLine &ours, long long ref_cycle0, long long cycle0,
+                            bool ppu )
+{
+	const std::pair< bool, const char * > checks[] = {
+		{ ref.pc != ours.pc, "PC" },
+		{ ref.bytes != ours.bytes, "instruction bytes" },
+		{ ref.a != ours.a, "A" },
+		{ ref.x != ours.x, "X" },
+		{ ref.y != ours.y, "Y" },
+		{ ref.p != ours.p, "P" },
+		{ ref.s != ours.s, "SP" },
+		{ ref.cycle >= 0 && ref.cycle - ref_cycle0 != ours.cycle - cycle0, "CYC" },
+		{ ppu && ref.has_ppu && (ref.scanline != ours.scanline || ref.dot != ours.dot), "PPU" }
+	};
+	for ( const auto &[differs, field] : checks )
+	{
+		if ( differs )
+		{
+			return field;
+		}
+	}
+	return nullptr;
+}
+
+static int diff( const std::vector< Trace::Record > &records, const char *ref_path, bool ppu )
+{
+	std::ifstream ref_file( ref_path );
+	if ( !ref_file.good() )
+	{
+		std::cerr << ref_path << ": can't open" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::vector< std::string > ref;
+	for ( std::string line; std::getline( ref_file, line ); )
+	{
+		if ( !line.empty() && line.back() == '\r' )
+		{
+			line.pop_back();
+		}
+		if ( !line.empty() )
+		{
+			ref.push_back( line );
+		}
+	}
+
+	std::vector< const Trace::Record * > instructions;
+	for ( const Trace::Record &rec : records )
+	{
+		if ( rec.kind == Trace::INSTRUCTION )
+		{
+			instructions.push_back( &rec );
+		}
+	}
+
+	// Line the trace up with the first instruction that matches the first line of the reference
+	LogLine first = ref.empty() ? LogLine() : parse( ref[0] );
+	size_t start = 0;
+	while ( start < instructions.size()
+	        && compare( first, parse( render( *instructions[start] ) ), first.cycle, instructions[start]->cycle, ppu ) )
+	{
+		start++;
+	}
+	if ( start == instructions.size() )
+	{
+		std::cerr << "The trace never reaches the first line of the reference" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	long long ref_cycle0 = first.cycle;
+	long long cycle0 = instructions[start]->cycle;
+	size_t lines = std::min( ref.size(), instructions.size() - start );
+	for ( size_t i = 0; i < lines; i++ )
+	{
+		std::string ours = render( *instructions[start + i] );
+		const char *field = compare( parse( ref[i] ), parse( ours ), ref_cycle0, cycle0, ppu );
+		if ( field != nullptr )
+		{
+			std::cout << "Mismatch in " << field << " at line " << i + 1 << " of " << ref_path << ":\n";
+			for ( size_t j = i < 3 ? 0 : i - 3; j < i; j++ )
+			{
+				std::cout << "       " << ref[j] << "\n";
+			}
+			std::cout << "ref:   " << ref[i] << "\n";
+			std::cout << "trace: " << ours << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	std::cout << lines << " lines match";
+	if ( lines < ref.size() )
+	{
+		std::cout << " (the trace ends " << ref.size() - lines << " lines early)";
+	}
+	std::cout << std::endl;
+	return EXIT_SUCCESS;
+}
+
+int main( int argc, char *argv[] )
+{
+	const char *trace_path = nullptr;
+	const char *ref_path = nullptr;
+	bool bus = false;
+	bool ppu = false;
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( strcmp( argv[i], "--diff" ) == 0 && i + 1 < argc )
+		{
+			ref_path = argv[++i];
+		}
+		else if ( strcmp( argv[i], "--bus" ) == 0 )
+		{
+			bus = true;
+		}
+		else if ( strcmp( argv[i], "--ppu" ) == 0 )
+		{
+			ppu = true;
+		}
+		else
+		{
+			trace_path = argv[i];
+		}
+	}
+
+	if ( trace_path == nullptr )
+	{
+		std::cerr << "Usage: " << argv[0] << " <trace> [--bus] [--diff <reference log> [--ppu]]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector< Trace::Record > records;
+	if ( !Trace::load( trace_path, records ) )
+	{
+		std::cerr << trace_path << ": not a trace file from this build" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if ( ref_path != nullptr )
+	{
+		return diff( records, ref_path, ppu );
+	}
+
+	for ( const Trace::Record &rec : records )
+	{
+		if ( bus || rec.kind == Trace::INSTRUCTION )
+		{
+			std::cout << render( rec ) << "\n";
+		}
+	}
+	return EXIT_SUCCESS;
+}